@@ -2645,14 +2645,36 @@ ConVar cl_warn_thread_contested_bone_setup("cl_warn_thread_contested_bone_setup"
 #endif
 ConVar cl_threaded_bone_setup("cl_threaded_bone_setup", "0", 0, "Enable parallel processing of C_BaseAnimating::SetupBones()" );
 
+// Followers and other move-parented models are set up in passes ordered by
+// how many animating ancestors they have, so a parent's bones are always
+// cached before any child that bone merges or reads attachments from it.
+// Anything nested deeper than this is left to be set up on demand.
+#define MAX_BONE_SETUP_DEPTH	4
+
+static CUtlVector<C_BaseAnimating *> g_BoneSetupPasses[MAX_BONE_SETUP_DEPTH];
+
+//-----------------------------------------------------------------------------
+// Purpose: Returns the number of animating ancestors of pAnimating, or -1 if
+//			it's nested too deep to be set up by the job graph
+//-----------------------------------------------------------------------------
+static int BoneSetupDepth( C_BaseAnimating *pAnimating )
+{
+	int nDepth = 0;
+	for ( C_BaseEntity *pParent = pAnimating->GetMoveParent(); pParent; pParent = pParent->GetMoveParent() )
+	{
+		if ( pParent->GetBaseAnimating() && ++nDepth >= MAX_BONE_SETUP_DEPTH )
+			return -1;
+	}
+	return nDepth;
+}
+
 //-----------------------------------------------------------------------------
 // Purpose: Do the default sequence blending rules as done in HL1
 //-----------------------------------------------------------------------------
 
 static void SetupBonesOnBaseAnimating( C_BaseAnimating *&pBaseAnimating )
 {
-	if ( !pBaseAnimating->GetMoveParent() )
-		pBaseAnimating->SetupBones( NULL, -1, -1, gpGlobals->curtime );
+	pBaseAnimating->SetupBones( NULL, -1, -1, gpGlobals->curtime );
 }
 
 static void PreThreadedBoneSetup()
@@ -2684,9 +2706,36 @@ void C_BaseAnimating::ThreadedBoneSetup()
 		int nCount = g_PreviousBoneSetups.Count();
 		if ( nCount > 1 )
 		{
+			// The hierarchy may have changed since the requests were recorded
+			// last frame, so work out the passes now
+			int i;
+			for ( i = 0; i < nCount; i++ )
+			{
+				C_BaseAnimating *pAnimating = g_PreviousBoneSetups[i];
+				int nDepth = BoneSetupDepth( pAnimating );
+				if ( nDepth >= 0 )
+				{
+					g_BoneSetupPasses[nDepth].AddToTail( pAnimating );
+				}
+			}
+
 			g_bInThreadedBoneSetup = true;
 
-			ParallelProcess( "C_BaseAnimating::ThreadedBoneSetup", g_PreviousBoneSetups.Base(), nCount, &SetupBonesOnBaseAnimating, &PreThreadedBoneSetup, &PostThreadedBoneSetup );
+			for ( i = 0; i < MAX_BONE_SETUP_DEPTH; i++ )
+			{
+				CUtlVector<C_BaseAnimating *> &pass = g_BoneSetupPasses[i];
+				if ( pass.Count() > 1 )
+				{
+					ParallelProcess( "C_BaseAnimating::ThreadedBoneSetup", pass.Base(), pass.Count(), &SetupBonesOnBaseAnimating, &PreThreadedBoneSetup, &PostThreadedBoneSetup );
+				}
+				else if ( pass.Count() == 1 )
+				{
+					PreThreadedBoneSetup();
+					SetupBonesOnBaseAnimating( pass[0] );
+					PostThreadedBoneSetup();
+				}
+				pass.RemoveAll();
+			}
 
 			g_bInThreadedBoneSetup = false;
 		}
@@ -2796,11 +2845,23 @@ bool C_BaseAnimating::SetupBones( matrix3x4_t *pBoneToWorldOut, int nMaxBones, i
 	}
 
 	int nBoneCount = m_CachedBoneData.Count();
-	if ( g_bDoThreadedBoneSetup && !g_bInThreadedBoneSetup && ( nBoneCount >= 16 ) && !GetMoveParent() && m_iMostRecentBoneSetupRequest != g_iPreviousBoneCounter )
+	if ( g_bDoThreadedBoneSetup && !g_bInThreadedBoneSetup && ( nBoneCount >= 16 ) && m_iMostRecentBoneSetupRequest != g_iPreviousBoneCounter )
 	{
 		m_iMostRecentBoneSetupRequest = g_iPreviousBoneCounter;
 		Assert( g_PreviousBoneSetups.Find( this ) == -1 );
 		g_PreviousBoneSetups.AddToTail( this );
+
+		// Children read their parents' bones, so make sure every animating
+		// ancestor gets its own job in an earlier pass
+		for ( C_BaseEntity *pParent = GetMoveParent(); pParent; pParent = pParent->GetMoveParent() )
+		{
+			C_BaseAnimating *pAnimatingParent = pParent->GetBaseAnimating();
+			if ( pAnimatingParent && pAnimatingParent->m_iMostRecentBoneSetupRequest != g_iPreviousBoneCounter )
+			{
+				pAnimatingParent->m_iMostRecentBoneSetupRequest = g_iPreviousBoneCounter;
+				g_PreviousBoneSetups.AddToTail( pAnimatingParent );
+			}
+		}
 	}
 
 	// Keep track of everthing asked for over the entire frame
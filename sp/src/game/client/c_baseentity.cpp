@@ -40,6 +40,7 @@
 #include "cdll_bounded_cvars.h"
 #include "inetchannelinfo.h"
 #include "proto_version.h"
+#include "vstdlib/jobthread.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -76,6 +77,7 @@ void cc_cl_interp_all_changed( IConVar *pConVar, const char *pOldString, float f
 static ConVar  cl_extrapolate( "cl_extrapolate", "1", FCVAR_CHEAT, "Enable/disable extrapolation if interpolation history runs out." );
 static ConVar  cl_interp_npcs( "cl_interp_npcs", "0.0", FCVAR_USERINFO, "Interpolate NPC positions starting this many seconds in past (or cl_interp, if greater)" );  
 static ConVar  cl_interp_all( "cl_interp_all", "0", 0, "Disable interpolation list optimizations.", 0, 0, 0, 0, cc_cl_interp_all_changed );
+static ConVar  cl_threaded_interpolation( "cl_threaded_interpolation", "1", 0, "Compute interpolated values for the interpolation list on worker threads." );
 ConVar  r_drawmodeldecals( "r_drawmodeldecals", "1" );
 extern ConVar	cl_showerror;
 int C_BaseEntity::m_nPredictionRandomSeed = -1;
@@ -884,6 +886,21 @@ inline int C_BaseEntity::Interp_Interpolate( VarMapping_t *map, float currentTim
 	return bNoMoreChanges;
 }
 
+void C_BaseEntity::Interp_PrepareInterpolation( VarMapping_t *map, float currentTime )
+{
+	// Mirror the entries Interp_Interpolate will visit. This must not write anything but the
+	// watchers' prepared results, since other entities are being prepared at the same time.
+	bool bWentBack = ( currentTime < map->m_lastInterpolationTime );
+	for ( int i = 0; i < map->m_nInterpolatedEntries; i++ )
+	{
+		VarMapEntry_t *e = &map->m_Entries[ i ];
+		if ( !e->m_bNeedsToInterpolate && !bWentBack )
+			continue;
+
+		e->watcher->PrepareInterpolation( currentTime );
+	}
+}
+
 //-----------------------------------------------------------------------------
 // Functions.
 //-----------------------------------------------------------------------------
@@ -3077,10 +3094,47 @@ void C_BaseEntity::CheckInterpolatedVarParanoidMeasurement()
 }
 
 
+// Below this many entities it's cheaper to just interpolate on the main thread.
+#define MIN_THREADED_INTERPOLATION_ENTITIES	16
+
+static CUtlVector<C_BaseEntity *> g_PrepareInterpolationList;
+
+static void PrepareInterpolationOnEntity( C_BaseEntity *&pEntity )
+{
+	pEntity->Interp_PrepareInterpolation( pEntity->GetVarMapping(), gpGlobals->curtime );
+}
+
 void C_BaseEntity::ProcessInterpolatedList()
 {
 	CheckInterpolatedVarParanoidMeasurement();
 
+	// Work out the interpolated values on the job threads first. Interpolate() below
+	// still runs serially so subclasses see the old and new values as before, but it
+	// only has to copy the prepared results in.
+	bool bPrepared = false;
+	if ( cl_threaded_interpolation.GetBool() && IsInterpolationEnabled() && g_InterpolationList.Count() >= MIN_THREADED_INTERPOLATION_ENTITIES )
+	{
+		for ( int iCur=g_InterpolationList.Head(); iCur != g_InterpolationList.InvalidIndex(); iCur=g_InterpolationList.Next( iCur ) )
+		{
+			C_BaseEntity *pCur = g_InterpolationList[iCur];
+
+			// Predicted and client created entities interpolate at a different time, and
+			// followers just snap to their last received position.
+			if ( pCur->GetPredictable() || pCur->IsClientCreated() || pCur->IsFollowingEntity() )
+				continue;
+
+			g_PrepareInterpolationList.AddToTail( pCur );
+		}
+
+		if ( g_PrepareInterpolationList.Count() )
+		{
+			Interpolation_FlushPrepared();
+			ParallelProcess( "C_BaseEntity::ProcessInterpolatedList", g_PrepareInterpolationList.Base(), g_PrepareInterpolationList.Count(), &PrepareInterpolationOnEntity );
+			g_PrepareInterpolationList.RemoveAll();
+			bPrepared = true;
+		}
+	}
+
 	// Interpolate the minimal set of entities that need it.
 	int iNext;
 	for ( int iCur=g_InterpolationList.Head(); iCur != g_InterpolationList.InvalidIndex(); iCur=iNext )
@@ -3090,6 +3144,13 @@ void C_BaseEntity::ProcessInterpolatedList()
 		
 		pCur->m_bReadyToDraw = pCur->Interpolate( gpGlobals->curtime );
 	}
+
+	// Anything that didn't get used (ragdolls, entities that dropped out of the list)
+	// mustn't be picked up by a later Interpolate() call.
+	if ( bPrepared )
+	{
+		Interpolation_FlushPrepared();
+	}
 }
 
 
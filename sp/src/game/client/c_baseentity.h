@@ -230,6 +230,9 @@ public:
 	
 	// Returns 1 if there are no more changes (ie: we could call RemoveFromInterpolationList).
 	int								Interp_Interpolate( VarMapping_t *map, float currentTime );
+
+	// Computes the values the next Interp_Interpolate() call will apply. Safe to call from worker threads.
+	void							Interp_PrepareInterpolation( VarMapping_t *map, float currentTime );
 	
 	void							Interp_RestoreToLastNetworked( VarMapping_t *map );
 	void							Interp_UpdateInterpolationAmounts( VarMapping_t *map );
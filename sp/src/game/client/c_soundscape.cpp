@@ -15,6 +15,7 @@
 #include "view.h"
 #include "engine/ivdebugoverlay.h"
 #include "tier0/icommandline.h"
+#include "tier1/UtlStringMap.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -55,7 +56,7 @@ struct randomsound_t
 	int			waveCount;
 	bool		isAmbient;
 	bool		isRandom;
-	KeyValues	*pWaves;
+	int			firstWave;		// index of the first of waveCount entries in m_randomWaves
 
 	void Init()
 	{
@@ -75,6 +76,56 @@ struct subsoundscapeparams_t
 	bool	wroteDSPVolume;
 };
 
+enum soundscapecommandtype_t
+{
+	SOUNDSCAPE_CMD_DSP = 0,			// "dsp"
+	SOUNDSCAPE_CMD_DSP_PLAYER,		// "dsp_player"
+	SOUNDSCAPE_CMD_PLAYLOOPING,		// "playlooping"
+	SOUNDSCAPE_CMD_PLAYRANDOM,		// "playrandom"
+	SOUNDSCAPE_CMD_PLAYSOUNDSCAPE,	// "playsoundscape"
+	SOUNDSCAPE_CMD_SOUNDMIXER,		// "soundmixer"
+	SOUNDSCAPE_CMD_DSP_VOLUME,		// "dsp_volume"
+};
+
+// One root level soundscape key with its sub keys already read into numbers and
+// intervals, so starting a soundscape doesn't have to walk and parse KeyValues.
+// The random parts (volume, pitch...) are still rolled each time it starts.
+struct soundscapecommand_t
+{
+	soundscapecommandtype_t type;
+	int			intValue;			// dsp, dsp_player
+	float		floatValue;			// dsp_volume
+	const char	*pName;				// soundmixer, playlooping wave, playsoundscape name
+	int			soundscapeIndex;	// playsoundscape, resolved once all the scripts are loaded
+	interval_t	volume;				// playlooping, playsoundscape
+	interval_t	pitch;				// playlooping
+	interval_t	soundlevel;			// playlooping
+	bool		soundlevelIsAttenuation;
+	bool		hasVolume;			// playsoundscape
+	bool		hasPosition;
+	bool		hasPositionOverride;
+	bool		hasAmbientPositionOverride;
+	bool		randomPosition;		// playrandom
+	bool		suppressOnRestore;
+	int			position;
+	int			positionOverride;
+	int			ambientPositionOverride;
+	randomsound_t random;			// playrandom, all but master volume and placement
+
+	void Init()
+	{
+		memset( this, 0, sizeof(*this) );
+		soundscapeIndex = -1;
+	}
+};
+
+// The commands of one soundscape in m_soundscapeCommands
+struct soundscapeprogram_t
+{
+	int		firstCommand;
+	int		commandCount;
+};
+
 class C_SoundscapeSystem : public CBaseGameSystemPerFrame
 {
 public:
@@ -184,28 +235,27 @@ public:
 
 	int FindSoundscapeByName( const char *pSoundscapeName );
 	const char *SoundscapeNameByIndex( int index );
-	KeyValues *SoundscapeByIndex( int index );
 	
-	// main-level soundscape processing, called on new soundscape
-	void StartNewSoundscape( KeyValues *pSoundscape );
-	void StartSubSoundscape( KeyValues *pSoundscape, subsoundscapeparams_t &params );
+	// main-level soundscape processing, called on new soundscape (-1 for none)
+	void StartNewSoundscape( int index );
+	void StartSubSoundscape( int index, subsoundscapeparams_t &params );
 
 	// root level soundscape keys
 	// add a process for each new command here
 	// "dsp"
-	void ProcessDSP( KeyValues *pDSP );
+	void ProcessDSP( const soundscapecommand_t &cmd );
 	// "dsp_player"
-	void ProcessDSPPlayer( KeyValues *pDSPPlayer );
+	void ProcessDSPPlayer( const soundscapecommand_t &cmd );
 	// "playlooping"
-	void ProcessPlayLooping( KeyValues *pPlayLooping, const subsoundscapeparams_t &params );	
+	void ProcessPlayLooping( const soundscapecommand_t &cmd, const subsoundscapeparams_t &params );	
 	// "playrandom"
-	void ProcessPlayRandom( KeyValues *pPlayRandom, const subsoundscapeparams_t &params );
+	void ProcessPlayRandom( const soundscapecommand_t &cmd, const subsoundscapeparams_t &params );
 	// "playsoundscape"
-	void ProcessPlaySoundscape( KeyValues *pPlaySoundscape, subsoundscapeparams_t &params );
+	void ProcessPlaySoundscape( const soundscapecommand_t &cmd, subsoundscapeparams_t &params );
 	// "soundmixer"
-	void ProcessSoundMixer( KeyValues *pSoundMixer, subsoundscapeparams_t &params );
+	void ProcessSoundMixer( const soundscapecommand_t &cmd, subsoundscapeparams_t &params );
 	// "dsp_volume"
-	void ProcessDSPVolume( KeyValues *pKey, subsoundscapeparams_t &params );
+	void ProcessDSPVolume( const soundscapecommand_t &cmd, subsoundscapeparams_t &params );
 
 
 private:
@@ -217,9 +267,14 @@ private:
 
 	void	AddSoundScapeFile( const char *filename );
 
-	void		TouchPlayLooping( KeyValues *pAmbient );
-	void		TouchPlayRandom( KeyValues *pPlayRandom );
-	void		TouchWaveFiles( KeyValues *pSoundScape );
+	// turn the KeyValues of each soundscape into its program
+	void	CompileSoundscape( KeyValues *pSoundscape );
+	void	CompilePlayLooping( KeyValues *pAmbient, soundscapecommand_t &cmd );
+	void	CompilePlayRandom( KeyValues *pPlayRandom, soundscapecommand_t &cmd );
+	void	CompilePlaySoundscape( KeyValues *pPlaySoundscape, soundscapecommand_t &cmd );
+	void	LinkSoundscapes();
+
+	void		TouchWaveFiles( int index );
 	void		TouchSoundFile( char const *wavefile );
 
 	void		TouchSoundFiles();
@@ -228,6 +283,10 @@ private:
 
 	CUtlVector< KeyValues * >	m_SoundscapeScripts;	// The whole script file in memory
 	CUtlVector<KeyValues *>		m_soundscapes;			// Lookup by index of each root section
+	CUtlVector<soundscapeprogram_t>	m_soundscapePrograms;	// Compiled m_soundscapes, same indices
+	CUtlVector<soundscapecommand_t>	m_soundscapeCommands;
+	CUtlVector<const char *>	m_randomWaves;			// playrandom waves, point into m_SoundscapeScripts
+	CUtlStringMap<int>			m_soundscapeIndices;	// soundscape name -> index, last one wins
 	audioparams_t				m_params;				// current player audio params
 	CUtlVector<loopingsound_t>	m_loopingSounds;		// list of currently playing sounds
 	CUtlVector<randomsound_t>	m_randomSounds;			// list of random sound commands
@@ -285,6 +344,7 @@ void C_SoundscapeSystem::AddSoundScapeFile( const char *filename )
 			if ( pKeys->GetFirstSubKey() )
 			{
 				m_soundscapes.AddToTail( pKeys );
+				CompileSoundscape( pKeys );
 			}
 			pKeys = pKeys->GetNextKey();
 		}
@@ -342,27 +402,263 @@ bool C_SoundscapeSystem::Init()
 
 	manifest->deleteThis();
 
+	LinkSoundscapes();
+
 	return true;
 }
 
+void C_SoundscapeSystem::CompileSoundscape( KeyValues *pSoundscape )
+{
+	int index = m_soundscapePrograms.AddToTail();
+	m_soundscapePrograms[index].firstCommand = m_soundscapeCommands.Count();
 
-int C_SoundscapeSystem::FindSoundscapeByName( const char *pSoundscapeName )
+	for ( KeyValues *pKey = pSoundscape->GetFirstSubKey(); pKey; pKey = pKey->GetNextKey() )
+	{
+		soundscapecommand_t cmd;
+		cmd.Init();
+
+		if ( !Q_strcasecmp( pKey->GetName(), "dsp" ) )
+		{
+			cmd.type = SOUNDSCAPE_CMD_DSP;
+			cmd.intValue = pKey->GetInt();
+		}
+		else if ( !Q_strcasecmp( pKey->GetName(), "dsp_player" ) )
+		{
+			cmd.type = SOUNDSCAPE_CMD_DSP_PLAYER;
+			cmd.intValue = pKey->GetInt();
+		}
+		else if ( !Q_strcasecmp( pKey->GetName(), "playlooping" ) )
+		{
+			cmd.type = SOUNDSCAPE_CMD_PLAYLOOPING;
+			CompilePlayLooping( pKey, cmd );
+		}
+		else if ( !Q_strcasecmp( pKey->GetName(), "playrandom" ) )
+		{
+			cmd.type = SOUNDSCAPE_CMD_PLAYRANDOM;
+			CompilePlayRandom( pKey, cmd );
+		}
+		else if ( !Q_strcasecmp( pKey->GetName(), "playsoundscape" ) )
+		{
+			cmd.type = SOUNDSCAPE_CMD_PLAYSOUNDSCAPE;
+			CompilePlaySoundscape( pKey, cmd );
+		}
+		else if ( !Q_strcasecmp( pKey->GetName(), "Soundmixer" ) )
+		{
+			cmd.type = SOUNDSCAPE_CMD_SOUNDMIXER;
+			cmd.pName = pKey->GetString();
+		}
+		else if ( !Q_strcasecmp( pKey->GetName(), "dsp_volume" ) )
+		{
+			cmd.type = SOUNDSCAPE_CMD_DSP_VOLUME;
+			cmd.floatValue = pKey->GetFloat();
+		}
+		// add new commands here
+		else
+		{
+			DevMsg( 1, "Soundscape %s:Unknown command %s\n", pSoundscape->GetName(), pKey->GetName() );
+			continue;
+		}
+
+		m_soundscapeCommands.AddToTail( cmd );
+	}
+
+	m_soundscapePrograms[index].commandCount = m_soundscapeCommands.Count() - m_soundscapePrograms[index].firstCommand;
+}
+
+void C_SoundscapeSystem::CompilePlayLooping( KeyValues *pAmbient, soundscapecommand_t &cmd )
 {
-	// UNDONE: Bad perf, linear search!
-	for ( int i = m_soundscapes.Count()-1; i >= 0; --i )
+	cmd.pitch.start = PITCH_NORM;
+	cmd.soundlevel.start = ATTN_TO_SNDLVL(ATTN_NORM);
+
+	KeyValues *pKey = pAmbient->GetFirstSubKey();
+	while ( pKey )
 	{
-		if ( !Q_stricmp( m_soundscapes[i]->GetName(), pSoundscapeName ) )
-			return i;
+		if ( !Q_strcasecmp( pKey->GetName(), "volume" ) )
+		{
+			cmd.volume = ReadInterval( pKey->GetString() );
+		}
+		else if ( !Q_strcasecmp( pKey->GetName(), "pitch" ) )
+		{
+			cmd.pitch = ReadInterval( pKey->GetString() );
+		}
+		else if ( !Q_strcasecmp( pKey->GetName(), "wave" ) )
+		{
+			cmd.pName = pKey->GetString();
+		}
+		else if ( !Q_strcasecmp( pKey->GetName(), "position" ) )
+		{
+			cmd.hasPosition = true;
+			cmd.position = pKey->GetInt();
+		}
+		else if ( !Q_strcasecmp( pKey->GetName(), "attenuation" ) )
+		{
+			cmd.soundlevel = ReadInterval( pKey->GetString() );
+			cmd.soundlevelIsAttenuation = true;
+		}
+		else if ( !Q_strcasecmp( pKey->GetName(), "soundlevel" ) )
+		{
+			if ( !Q_strncasecmp( pKey->GetString(), "SNDLVL_", strlen( "SNDLVL_" ) ) )
+			{
+				cmd.soundlevel.start = TextToSoundLevel( pKey->GetString() );
+				cmd.soundlevel.range = 0;
+			}
+			else
+			{
+				cmd.soundlevel = ReadInterval( pKey->GetString() );
+			}
+			cmd.soundlevelIsAttenuation = false;
+		}
+		else if ( !Q_strcasecmp( pKey->GetName(), "suppress_on_restore" ) )
+		{
+			cmd.suppressOnRestore = Q_atoi( pKey->GetString() ) != 0 ? true : false;
+		}
+		else
+		{
+			DevMsg( 1, "Ambient %s:Unknown command %s\n", pAmbient->GetName(), pKey->GetName() );
+		}
+		pKey = pKey->GetNextKey();
 	}
+}
+
+void C_SoundscapeSystem::CompilePlayRandom( KeyValues *pPlayRandom, soundscapecommand_t &cmd )
+{
+	randomsound_t &sound = cmd.random;
+	sound.Init();
 
-	return -1;
+	KeyValues *pKey = pPlayRandom->GetFirstSubKey();
+	while ( pKey )
+	{
+		if ( !Q_strcasecmp( pKey->GetName(), "volume" ) )
+		{
+			sound.volume = ReadInterval( pKey->GetString() );
+		}
+		else if ( !Q_strcasecmp( pKey->GetName(), "pitch" ) )
+		{
+			sound.pitch = ReadInterval( pKey->GetString() );
+		}
+		else if ( !Q_strcasecmp( pKey->GetName(), "attenuation" ) )
+		{
+			interval_t atten = ReadInterval( pKey->GetString() );
+			sound.soundlevel.start = ATTN_TO_SNDLVL( atten.start );
+			sound.soundlevel.range = ATTN_TO_SNDLVL( atten.start + atten.range ) - sound.soundlevel.start;
+		}
+		else if ( !Q_strcasecmp( pKey->GetName(), "soundlevel" ) )
+		{
+			if ( !Q_strncasecmp( pKey->GetString(), "SNDLVL_", strlen( "SNDLVL_" ) ) )
+			{
+				sound.soundlevel.start = TextToSoundLevel( pKey->GetString() );
+				sound.soundlevel.range = 0;
+			}
+			else
+			{
+				sound.soundlevel = ReadInterval( pKey->GetString() );
+			}
+		}
+		else if ( !Q_strcasecmp( pKey->GetName(), "time" ) )
+		{
+			sound.time = ReadInterval( pKey->GetString() );
+		}
+		else if ( !Q_strcasecmp( pKey->GetName(), "rndwave" ) )
+		{
+			sound.firstWave = m_randomWaves.Count();
+			sound.waveCount = 0;
+			for ( KeyValues *pWaves = pKey->GetFirstSubKey(); pWaves; pWaves = pWaves->GetNextKey() )
+			{
+				m_randomWaves.AddToTail( pWaves->GetString() );
+				sound.waveCount++;
+			}
+		}
+		else if ( !Q_strcasecmp( pKey->GetName(), "position" ) )
+		{
+			if ( !Q_strcasecmp( pKey->GetString(), "random" ) )
+			{
+				cmd.randomPosition = true;
+			}
+			else
+			{
+				cmd.hasPosition = true;
+				cmd.position = pKey->GetInt();
+			}
+		}
+		else if ( !Q_strcasecmp( pKey->GetName(), "suppress_on_restore" ) )
+		{
+			cmd.suppressOnRestore = Q_atoi( pKey->GetString() ) != 0 ? true : false;
+		}
+		else
+		{
+			DevMsg( 1, "Random Sound %s:Unknown command %s\n", pPlayRandom->GetName(), pKey->GetName() );
+		}
+
+		pKey = pKey->GetNextKey();
+	}
 }
 
-KeyValues *C_SoundscapeSystem::SoundscapeByIndex( int index )
+void C_SoundscapeSystem::CompilePlaySoundscape( KeyValues *pPlaySoundscape, soundscapecommand_t &cmd )
 {
-	if ( m_soundscapes.IsValidIndex(index) )
-		return m_soundscapes[index];
-	return NULL;
+	KeyValues *pKey = pPlaySoundscape->GetFirstSubKey();
+	while ( pKey )
+	{
+		if ( !Q_strcasecmp( pKey->GetName(), "volume" ) )
+		{
+			cmd.hasVolume = true;
+			cmd.volume = ReadInterval( pKey->GetString() );
+		}
+		else if ( !Q_strcasecmp( pKey->GetName(), "position" ) )
+		{
+			cmd.hasPosition = true;
+			cmd.position = pKey->GetInt();
+		}
+		else if ( !Q_strcasecmp( pKey->GetName(), "positionoverride" ) )
+		{
+			cmd.hasPositionOverride = true;
+			cmd.positionOverride = pKey->GetInt();
+		}
+		else if ( !Q_strcasecmp( pKey->GetName(), "ambientpositionoverride" ) )
+		{
+			cmd.hasAmbientPositionOverride = true;
+			cmd.ambientPositionOverride = pKey->GetInt();
+		}
+		else if ( !Q_strcasecmp( pKey->GetName(), "name" ) )
+		{
+			cmd.pName = pKey->GetString();
+		}
+		else if ( !Q_strcasecmp(pKey->GetName(), "soundlevel") )
+		{
+			DevMsg(1,"soundlevel not supported on sub-soundscapes\n");
+		}
+		else
+		{
+			DevMsg( 1, "Playsoundscape %s:Unknown command %s\n", cmd.pName ? cmd.pName : pPlaySoundscape->GetName(), pKey->GetName() );
+		}
+		pKey = pKey->GetNextKey();
+	}
+}
+
+// build the name lookup and point each playsoundscape at its target
+void C_SoundscapeSystem::LinkSoundscapes()
+{
+	for ( int i = 0; i < m_soundscapes.Count(); i++ )
+	{
+		m_soundscapeIndices[ m_soundscapes[i]->GetName() ] = i;
+	}
+
+	for ( int i = 0; i < m_soundscapeCommands.Count(); i++ )
+	{
+		soundscapecommand_t &cmd = m_soundscapeCommands[i];
+		if ( cmd.type == SOUNDSCAPE_CMD_PLAYSOUNDSCAPE && cmd.pName )
+		{
+			cmd.soundscapeIndex = FindSoundscapeByName( cmd.pName );
+		}
+	}
+}
+
+int C_SoundscapeSystem::FindSoundscapeByName( const char *pSoundscapeName )
+{
+	UtlSymId_t sym = m_soundscapeIndices.Find( pSoundscapeName );
+	if ( sym == m_soundscapeIndices.InvalidIndex() )
+		return -1;
+
+	return m_soundscapeIndices[sym];
 }
 
 const char *C_SoundscapeSystem::SoundscapeNameByIndex( int index )
@@ -390,6 +686,10 @@ void C_SoundscapeSystem::Shutdown()
 	m_loopingSounds.RemoveAll();
 	m_randomSounds.RemoveAll();
 	m_soundscapes.RemoveAll();
+	m_soundscapePrograms.RemoveAll();
+	m_soundscapeCommands.RemoveAll();
+	m_randomWaves.RemoveAll();
+	m_soundscapeIndices.Clear();
 	m_params.ent.Set( NULL );
 	m_params.soundscapeIndex = -1;
 
@@ -464,7 +764,7 @@ CON_COMMAND_F_COMPLETION( playsoundscape, "Forces a soundscape to play", FCVAR_C
 
 CON_COMMAND_F( stopsoundscape, "Stops all soundscape processing and fades current looping sounds", FCVAR_CHEAT )
 {
-	g_SoundscapeSystem.StartNewSoundscape( NULL );
+	g_SoundscapeSystem.StartNewSoundscape( -1 );
 }
 
 void C_SoundscapeSystem::ForceSoundscape( const char *pSoundscapeName, float radius )
@@ -474,7 +774,7 @@ void C_SoundscapeSystem::ForceSoundscape( const char *pSoundscapeName, float rad
 	{
 		m_forcedSoundscapeIndex = index;
 		m_forcedSoundscapeRadius = radius;
-		g_SoundscapeSystem.StartNewSoundscape( SoundscapeByIndex(index) );
+		g_SoundscapeSystem.StartNewSoundscape( index );
 	}
 	else
 	{
@@ -562,7 +862,7 @@ void C_SoundscapeSystem::UpdateAudioParams( audioparams_t &audio )
 	if ( audio.ent.Get() && audio.soundscapeIndex >= 0 && audio.soundscapeIndex < m_soundscapes.Count() )
 	{
 		DevReportSoundscapeName( audio.soundscapeIndex );
-		StartNewSoundscape( m_soundscapes[audio.soundscapeIndex] );
+		StartNewSoundscape( audio.soundscapeIndex );
 	}
 	else
 	{
@@ -578,16 +878,17 @@ void C_SoundscapeSystem::UpdateAudioParams( audioparams_t &audio )
 
 
 // Called when a soundscape is activated (leading edge of becoming the active soundscape)
-void C_SoundscapeSystem::StartNewSoundscape( KeyValues *pSoundscape )
+void C_SoundscapeSystem::StartNewSoundscape( int index )
 {
 	int i;
+	bool bHasSoundscape = m_soundscapePrograms.IsValidIndex( index );
 
 	// Reset the system
 	// fade out the current loops
 	for ( i = m_loopingSounds.Count()-1; i >= 0; --i )
 	{
 		m_loopingSounds[i].volumeTarget = 0;
-		if ( !pSoundscape )
+		if ( !bHasSoundscape )
 		{
 			// if we're cancelling the soundscape, stop the sound immediately
 			m_loopingSounds[i].volumeCurrent = 0;
@@ -600,7 +901,7 @@ void C_SoundscapeSystem::StartNewSoundscape( KeyValues *pSoundscape )
 	m_randomSounds.RemoveAll();
 	m_nextRandomTime = gpGlobals->curtime;
 
-	if ( pSoundscape )
+	if ( bHasSoundscape )
 	{
 		subsoundscapeparams_t params;
 		params.allowDSP = true;
@@ -612,7 +913,7 @@ void C_SoundscapeSystem::StartNewSoundscape( KeyValues *pSoundscape )
 		params.recurseLevel = 0;
 		params.positionOverride = -1;
 		params.ambientPositionOverride = -1;
-		StartSubSoundscape( pSoundscape, params );
+		StartSubSoundscape( index, params );
 
 		if ( !params.wroteDSPVolume )
 		{
@@ -625,151 +926,106 @@ void C_SoundscapeSystem::StartNewSoundscape( KeyValues *pSoundscape )
 	}
 }
 
-void C_SoundscapeSystem::StartSubSoundscape( KeyValues *pSoundscape, subsoundscapeparams_t &params )
+void C_SoundscapeSystem::StartSubSoundscape( int index, subsoundscapeparams_t &params )
 {
-	// Parse/process all of the commands
-	KeyValues *pKey = pSoundscape->GetFirstSubKey();
-	while ( pKey )
+	// Run all of the commands
+	const soundscapeprogram_t &program = m_soundscapePrograms[index];
+	for ( int i = 0; i < program.commandCount; i++ )
 	{
-		if ( !Q_strcasecmp( pKey->GetName(), "dsp" ) )
+		const soundscapecommand_t &cmd = m_soundscapeCommands[ program.firstCommand + i ];
+		switch ( cmd.type )
 		{
+		case SOUNDSCAPE_CMD_DSP:
 			if ( params.allowDSP )
 			{
-				ProcessDSP( pKey );
+				ProcessDSP( cmd );
 			}
-		}
-		else if ( !Q_strcasecmp( pKey->GetName(), "dsp_player" ) )
-		{
+			break;
+		case SOUNDSCAPE_CMD_DSP_PLAYER:
 			if ( params.allowDSP )
 			{
-				ProcessDSPPlayer( pKey );
+				ProcessDSPPlayer( cmd );
 			}
-		}
-		else if ( !Q_strcasecmp( pKey->GetName(), "playlooping" ) )
-		{
-			ProcessPlayLooping( pKey, params );
-		}
-		else if ( !Q_strcasecmp( pKey->GetName(), "playrandom" ) )
-		{
-			ProcessPlayRandom( pKey, params );
-		}
-		else if ( !Q_strcasecmp( pKey->GetName(), "playsoundscape" ) )
-		{
-			ProcessPlaySoundscape( pKey, params );
-		}
-		else if ( !Q_strcasecmp( pKey->GetName(), "Soundmixer" ) )
-		{
+			break;
+		case SOUNDSCAPE_CMD_PLAYLOOPING:
+			ProcessPlayLooping( cmd, params );
+			break;
+		case SOUNDSCAPE_CMD_PLAYRANDOM:
+			ProcessPlayRandom( cmd, params );
+			break;
+		case SOUNDSCAPE_CMD_PLAYSOUNDSCAPE:
+			ProcessPlaySoundscape( cmd, params );
+			break;
+		case SOUNDSCAPE_CMD_SOUNDMIXER:
 			if ( params.allowDSP )
 			{
-				ProcessSoundMixer( pKey, params );
+				ProcessSoundMixer( cmd, params );
 			}
-		}
-		else if ( !Q_strcasecmp( pKey->GetName(), "dsp_volume" ) )
-		{
+			break;
+		case SOUNDSCAPE_CMD_DSP_VOLUME:
 			if ( params.allowDSP )
 			{
-				ProcessDSPVolume( pKey, params );
+				ProcessDSPVolume( cmd, params );
 			}
+			break;
 		}
-		// add new commands here
-		else
-		{
-			DevMsg( 1, "Soundscape %s:Unknown command %s\n", pSoundscape->GetName(), pKey->GetName() );
-		}
-		pKey = pKey->GetNextKey();
 	}
 }
 
 // add a process for each new command here
 
 // change DSP effect
-void C_SoundscapeSystem::ProcessDSP( KeyValues *pDSP )
+void C_SoundscapeSystem::ProcessDSP( const soundscapecommand_t &cmd )
 {
-	int roomType = pDSP->GetInt();
+	int roomType = cmd.intValue;
 	CLocalPlayerFilter filter;
 	enginesound->SetRoomType( filter, roomType );
 }
 
 //-----------------------------------------------------------------------------
 // Purpose: 
-// Input  : *pDSPPlayer - 
+// Input  : &cmd - 
 //-----------------------------------------------------------------------------
-void C_SoundscapeSystem::ProcessDSPPlayer( KeyValues *pDSPPlayer )
+void C_SoundscapeSystem::ProcessDSPPlayer( const soundscapecommand_t &cmd )
 {
-	int dspType = pDSPPlayer->GetInt();
+	int dspType = cmd.intValue;
 	CLocalPlayerFilter filter;
 	enginesound->SetPlayerDSP( filter, dspType, false );
 }
 
 
-void C_SoundscapeSystem::ProcessSoundMixer( KeyValues *pSoundMixer, subsoundscapeparams_t &params )
+void C_SoundscapeSystem::ProcessSoundMixer( const soundscapecommand_t &cmd, subsoundscapeparams_t &params )
 {
 	C_BasePlayer *pPlayer = C_BasePlayer::GetLocalPlayer();
 	if ( !pPlayer || pPlayer->CanSetSoundMixer() )
 	{
-		m_pSoundMixerVar->SetValue( pSoundMixer->GetString() );
+		m_pSoundMixerVar->SetValue( cmd.pName );
 		params.wroteSoundMixer = true;
 	}
 }
 
-void C_SoundscapeSystem::ProcessDSPVolume( KeyValues *pKey, subsoundscapeparams_t &params )
+void C_SoundscapeSystem::ProcessDSPVolume( const soundscapecommand_t &cmd, subsoundscapeparams_t &params )
 {
-	m_pDSPVolumeVar->SetValue( pKey->GetFloat() );
+	m_pDSPVolumeVar->SetValue( cmd.floatValue );
 	params.wroteDSPVolume = true;
 }
 
 // start a new looping sound
-void C_SoundscapeSystem::ProcessPlayLooping( KeyValues *pAmbient, const subsoundscapeparams_t &params )
+void C_SoundscapeSystem::ProcessPlayLooping( const soundscapecommand_t &cmd, const subsoundscapeparams_t &params )
 {
-	float volume = 0;
-	soundlevel_t soundlevel = ATTN_TO_SNDLVL(ATTN_NORM);
-	const char *pSoundName = NULL;
-	int pitch = PITCH_NORM;
-	int positionIndex = -1;
-	bool suppress = false;
-	KeyValues *pKey = pAmbient->GetFirstSubKey();
-	while ( pKey )
+	float volume = params.masterVolume * RandomInterval( cmd.volume );
+	int pitch = RandomInterval( cmd.pitch );
+	const char *pSoundName = cmd.pName;
+	int positionIndex = cmd.hasPosition ? params.startingPosition + cmd.position : -1;
+	bool suppress = cmd.suppressOnRestore;
+	soundlevel_t soundlevel;
+	if ( cmd.soundlevelIsAttenuation )
 	{
-		if ( !Q_strcasecmp( pKey->GetName(), "volume" ) )
-		{
-			volume = params.masterVolume * RandomInterval( ReadInterval( pKey->GetString() ) );
-		}
-		else if ( !Q_strcasecmp( pKey->GetName(), "pitch" ) )
-		{
-			pitch = RandomInterval( ReadInterval( pKey->GetString() ) );
-		}
-		else if ( !Q_strcasecmp( pKey->GetName(), "wave" ) )
-		{
-			pSoundName = pKey->GetString();
-		}
-		else if ( !Q_strcasecmp( pKey->GetName(), "position" ) )
-		{
-			positionIndex = params.startingPosition + pKey->GetInt();
-		}
-		else if ( !Q_strcasecmp( pKey->GetName(), "attenuation" ) )
-		{
-			soundlevel = ATTN_TO_SNDLVL( RandomInterval( ReadInterval( pKey->GetString() ) ) );
-		}
-		else if ( !Q_strcasecmp( pKey->GetName(), "soundlevel" ) )
-		{
-			if ( !Q_strncasecmp( pKey->GetString(), "SNDLVL_", strlen( "SNDLVL_" ) ) )
-			{
-				soundlevel = TextToSoundLevel( pKey->GetString() );
-			}
-			else
-			{
-				soundlevel = (soundlevel_t)((int)RandomInterval( ReadInterval( pKey->GetString() ) ));
-			}
-		}
-		else if ( !Q_strcasecmp( pKey->GetName(), "suppress_on_restore" ) )
-		{
-			suppress = Q_atoi( pKey->GetString() ) != 0 ? true : false;
-		}
-		else
-		{
-			DevMsg( 1, "Ambient %s:Unknown command %s\n", pAmbient->GetName(), pKey->GetName() );
-		}
-		pKey = pKey->GetNextKey();
+		soundlevel = ATTN_TO_SNDLVL( RandomInterval( cmd.soundlevel ) );
+	}
+	else
+	{
+		soundlevel = (soundlevel_t)((int)RandomInterval( cmd.soundlevel ));
 	}
 
 	if ( positionIndex < 0 )
@@ -811,25 +1067,6 @@ void C_SoundscapeSystem::TouchSoundFile( char const *wavefile )
 	filesystem->GetFileTime( VarArgs( "sound/%s", PSkipSoundChars( wavefile ) ), "GAME" );
 }
 
-// start a new looping sound
-void C_SoundscapeSystem::TouchPlayLooping( KeyValues *pAmbient )
-{
-	KeyValues *pKey = pAmbient->GetFirstSubKey();
-	while ( pKey )
-	{
-		if ( !Q_strcasecmp( pKey->GetName(), "wave" ) )
-		{
-			char const *pSoundName = pKey->GetString();
-
-			// Touch the file
-			TouchSoundFile( pSoundName );
-		}
-
-		pKey = pKey->GetNextKey();
-	}
-}
-
-
 Vector C_SoundscapeSystem::GenerateRandomSoundPosition()
 {
 	float angle = random->RandomFloat( -180, 180 );
@@ -856,125 +1093,41 @@ void C_SoundscapeSystem::TouchSoundFiles()
 	int c = m_soundscapes.Count();
 	for ( int i = 0; i < c ; ++i )
 	{
-		TouchWaveFiles( m_soundscapes[ i ] );
+		TouchWaveFiles( i );
 	}
 }
 
-void C_SoundscapeSystem::TouchWaveFiles( KeyValues *pSoundScape )
+void C_SoundscapeSystem::TouchWaveFiles( int index )
 {
-	KeyValues *pKey = pSoundScape->GetFirstSubKey();
-	while ( pKey )
+	const soundscapeprogram_t &program = m_soundscapePrograms[index];
+	for ( int i = 0; i < program.commandCount; i++ )
 	{
-		if ( !Q_strcasecmp( pKey->GetName(), "playlooping" ) )
-		{
-			TouchPlayLooping( pKey );
-		}
-		else if ( !Q_strcasecmp( pKey->GetName(), "playrandom" ) )
+		const soundscapecommand_t &cmd = m_soundscapeCommands[ program.firstCommand + i ];
+		if ( cmd.type == SOUNDSCAPE_CMD_PLAYLOOPING )
 		{
-			TouchPlayRandom( pKey );
+			if ( cmd.pName )
+			{
+				TouchSoundFile( cmd.pName );
+			}
 		}
-
-		pKey = pKey->GetNextKey();
-	}
-
-}
-
-// puts a recurring random sound event into the queue
-void C_SoundscapeSystem::TouchPlayRandom( KeyValues *pPlayRandom )
-{
-	KeyValues *pKey = pPlayRandom->GetFirstSubKey();
-	while ( pKey )
-	{
-		if ( !Q_strcasecmp( pKey->GetName(), "rndwave" ) )
+		else if ( cmd.type == SOUNDSCAPE_CMD_PLAYRANDOM )
 		{
-			KeyValues *pWaves = pKey->GetFirstSubKey();
-			while ( pWaves )
+			for ( int j = 0; j < cmd.random.waveCount; j++ )
 			{
-				TouchSoundFile( pWaves->GetString() );
-
-				pWaves = pWaves->GetNextKey();
+				TouchSoundFile( m_randomWaves[ cmd.random.firstWave + j ] );
 			}
 		}
-
-		pKey = pKey->GetNextKey();
 	}
 }
 
 // puts a recurring random sound event into the queue
-void C_SoundscapeSystem::ProcessPlayRandom( KeyValues *pPlayRandom, const subsoundscapeparams_t &params )
+void C_SoundscapeSystem::ProcessPlayRandom( const soundscapecommand_t &cmd, const subsoundscapeparams_t &params )
 {
-	randomsound_t sound;
-	sound.Init();
+	randomsound_t sound = cmd.random;
 	sound.masterVolume = params.masterVolume;
-	int positionIndex = -1;
-	bool suppress = false;
-	bool randomPosition = false;
-	KeyValues *pKey = pPlayRandom->GetFirstSubKey();
-	while ( pKey )
-	{
-		if ( !Q_strcasecmp( pKey->GetName(), "volume" ) )
-		{
-			sound.volume = ReadInterval( pKey->GetString() );
-		}
-		else if ( !Q_strcasecmp( pKey->GetName(), "pitch" ) )
-		{
-			sound.pitch = ReadInterval( pKey->GetString() );
-		}
-		else if ( !Q_strcasecmp( pKey->GetName(), "attenuation" ) )
-		{
-			interval_t atten = ReadInterval( pKey->GetString() );
-			sound.soundlevel.start = ATTN_TO_SNDLVL( atten.start );
-			sound.soundlevel.range = ATTN_TO_SNDLVL( atten.start + atten.range ) - sound.soundlevel.start;
-		}
-		else if ( !Q_strcasecmp( pKey->GetName(), "soundlevel" ) )
-		{
-			if ( !Q_strncasecmp( pKey->GetString(), "SNDLVL_", strlen( "SNDLVL_" ) ) )
-			{
-				sound.soundlevel.start = TextToSoundLevel( pKey->GetString() );
-				sound.soundlevel.range = 0;
-			}
-			else
-			{
-				sound.soundlevel = ReadInterval( pKey->GetString() );
-			}
-		}
-		else if ( !Q_strcasecmp( pKey->GetName(), "time" ) )
-		{
-			sound.time = ReadInterval( pKey->GetString() );
-		}
-		else if ( !Q_strcasecmp( pKey->GetName(), "rndwave" ) )
-		{
-			KeyValues *pWaves = pKey->GetFirstSubKey();
-			sound.pWaves = pWaves;
-			sound.waveCount = 0;
-			while ( pWaves )
-			{
-				sound.waveCount++;
-				pWaves = pWaves->GetNextKey();
-			}
-		}
-		else if ( !Q_strcasecmp( pKey->GetName(), "position" ) )
-		{
-			if ( !Q_strcasecmp( pKey->GetString(), "random" ) )
-			{
-				randomPosition = true;
-			}
-			else
-			{
-				positionIndex = params.startingPosition + pKey->GetInt();
-			}
-		}
-		else if ( !Q_strcasecmp( pKey->GetName(), "suppress_on_restore" ) )
-		{
-			suppress = Q_atoi( pKey->GetString() ) != 0 ? true : false;
-		}
-		else
-		{
-			DevMsg( 1, "Random Sound %s:Unknown command %s\n", pPlayRandom->GetName(), pKey->GetName() );
-		}
-
-		pKey = pKey->GetNextKey();
-	}
+	int positionIndex = cmd.hasPosition ? params.startingPosition + cmd.position : -1;
+	bool suppress = cmd.suppressOnRestore;
+	bool randomPosition = cmd.randomPosition;
 
 	if ( positionIndex < 0 )
 	{
@@ -1021,7 +1174,7 @@ void C_SoundscapeSystem::ProcessPlayRandom( KeyValues *pPlayRandom, const subsou
 	}
 }
 
-void C_SoundscapeSystem::ProcessPlaySoundscape( KeyValues *pPlaySoundscape, subsoundscapeparams_t &paramsIn )
+void C_SoundscapeSystem::ProcessPlaySoundscape( const soundscapecommand_t &cmd, subsoundscapeparams_t &paramsIn )
 {
 	subsoundscapeparams_t subParams = paramsIn;
 	
@@ -1033,60 +1186,36 @@ void C_SoundscapeSystem::ProcessPlaySoundscape( KeyValues *pPlaySoundscape, subs
 		DevMsg( "Error!  Soundscape recursion overrun!\n" );
 		return;
 	}
-	KeyValues *pKey = pPlaySoundscape->GetFirstSubKey();
-	const char *pSoundscapeName = NULL;
-	while ( pKey )
+
+	if ( cmd.hasVolume )
 	{
-		if ( !Q_strcasecmp( pKey->GetName(), "volume" ) )
-		{
-			subParams.masterVolume = paramsIn.masterVolume * RandomInterval( ReadInterval( pKey->GetString() ) );
-		}
-		else if ( !Q_strcasecmp( pKey->GetName(), "position" ) )
-		{
-			subParams.startingPosition = paramsIn.startingPosition + pKey->GetInt();
-		}
-		else if ( !Q_strcasecmp( pKey->GetName(), "positionoverride" ) )
-		{
-			if ( paramsIn.positionOverride < 0 )
-			{
-				subParams.positionOverride = paramsIn.startingPosition + pKey->GetInt();
-				// positionoverride is only ever used to make a whole soundscape come from a point in space
-				// So go ahead and default ambients there too.
-				subParams.ambientPositionOverride = paramsIn.startingPosition + pKey->GetInt();
-			}
-		}
-		else if ( !Q_strcasecmp( pKey->GetName(), "ambientpositionoverride" ) )
-		{
-			if ( paramsIn.ambientPositionOverride < 0 )
-			{
-				subParams.ambientPositionOverride = paramsIn.startingPosition + pKey->GetInt();
-			}
-		}
-		else if ( !Q_strcasecmp( pKey->GetName(), "name" ) )
-		{
-			pSoundscapeName = pKey->GetString();
-		}
-		else if ( !Q_strcasecmp(pKey->GetName(), "soundlevel") )
-		{
-			DevMsg(1,"soundlevel not supported on sub-soundscapes\n");
-		}
-		else
-		{
-			DevMsg( 1, "Playsoundscape %s:Unknown command %s\n", pSoundscapeName ? pSoundscapeName : pPlaySoundscape->GetName(), pKey->GetName() );
-		}
-		pKey = pKey->GetNextKey();
+		subParams.masterVolume = paramsIn.masterVolume * RandomInterval( cmd.volume );
+	}
+	if ( cmd.hasPosition )
+	{
+		subParams.startingPosition = paramsIn.startingPosition + cmd.position;
+	}
+	if ( cmd.hasPositionOverride && paramsIn.positionOverride < 0 )
+	{
+		subParams.positionOverride = paramsIn.startingPosition + cmd.positionOverride;
+		// positionoverride is only ever used to make a whole soundscape come from a point in space
+		// So go ahead and default ambients there too.
+		subParams.ambientPositionOverride = paramsIn.startingPosition + cmd.positionOverride;
+	}
+	if ( cmd.hasAmbientPositionOverride && paramsIn.ambientPositionOverride < 0 )
+	{
+		subParams.ambientPositionOverride = paramsIn.startingPosition + cmd.ambientPositionOverride;
 	}
 
-	if ( pSoundscapeName )
+	if ( cmd.pName )
 	{
-		KeyValues *pSoundscapeKeys = SoundscapeByIndex( FindSoundscapeByName( pSoundscapeName ) );
-		if ( pSoundscapeKeys )
+		if ( cmd.soundscapeIndex >= 0 )
 		{
-			StartSubSoundscape( pSoundscapeKeys, subParams );
+			StartSubSoundscape( cmd.soundscapeIndex, subParams );
 		}
 		else
 		{
-			DevMsg( 1, "Trying to play unknown soundscape %s\n", pSoundscapeName );
+			DevMsg( 1, "Trying to play unknown soundscape %s\n", cmd.pName );
 		}
 	}
 }
@@ -1112,7 +1241,7 @@ int C_SoundscapeSystem::AddLoopingSound( const char *pSoundName, bool isAmbient,
 		// NOTE: Will always restart/crossfade positional sounds
 		if ( sound.id != m_loopingSoundId && 
 			sound.pitch == pitch && 
-			!Q_strcasecmp( pSoundName, sound.pWaveName ) )
+			( pSoundName == sound.pWaveName || !Q_strcasecmp( pSoundName, sound.pWaveName ) ) )
 		{
 			// Ambient sounds can reuse the slots.
 			if ( isAmbient == true && 
@@ -1248,16 +1377,7 @@ void C_SoundscapeSystem::PlayRandomSound( randomsound_t &sound )
 	Assert( sound.waveCount > 0 );
 
 	int waveId = random->RandomInt( 0, sound.waveCount-1 );
-	KeyValues *pWaves = sound.pWaves;
-	while ( waveId > 0 && pWaves )
-	{
-		pWaves = pWaves->GetNextKey();
-		waveId--;
-	}
-	if ( !pWaves )
-		return;
-	
-	const char *pWaveName = pWaves->GetString();
+	const char *pWaveName = m_randomWaves[ sound.firstWave + waveId ];
 	
 	if ( !pWaveName )
 		return;
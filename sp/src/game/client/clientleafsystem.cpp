@@ -33,6 +33,10 @@ static ConVar cl_drawleaf("cl_drawleaf", "-1", FCVAR_CHEAT );
 static ConVar r_PortalTestEnts( "r_PortalTestEnts", "1", FCVAR_CHEAT, "Clip entities against portal frustums." );
 static ConVar r_portalsopenall( "r_portalsopenall", "0", FCVAR_CHEAT, "Open all portals" );
 static ConVar cl_threaded_client_leaf_system("cl_threaded_client_leaf_system", "0"  );
+static ConVar cl_leafsystem_aabb_buffer( "cl_leafsystem_aabb_buffer", "4", FCVAR_CHEAT, "Expand a renderable's bbox by this much when placing it in the leaves so small movements don't force a reinsertion. 0 reinserts on every change." );
+
+// Don't bother farming leaf enumeration out to the job threads for fewer than this many renderables
+#define MIN_THREADED_REINSERTS	32
 
 
 DEFINE_FIXEDSIZE_ALLOCATOR( CClientRenderablesList, 1, CUtlMemoryPool::GROW_SLOW );
@@ -56,6 +60,27 @@ static void CallComputeFXBlend( IClientRenderable *&pRenderable )
 	pRenderable->ComputeFxBlend();
 }
 
+//-----------------------------------------------------------------------------
+// Threaded render list building: the world list leaves are split into runs of
+// contiguous leaves, each job collates its run into private lists, and the
+// lists are merged back in leaf order.
+//-----------------------------------------------------------------------------
+#define RENDER_LIST_LEAVES_PER_JOB	32
+
+struct RenderListJob_t
+{
+	const SetupRenderInfo_t *m_pInfo;
+	int m_nFirstLeaf;
+	int m_nLeafCount;
+	CUtlVector< CClientRenderablesList::CEntry > m_RenderGroups[RENDER_GROUP_COUNT];
+};
+
+// Packs a render frame and a world list leaf index into a single visit stamp
+inline int64 RenderListVisitStamp( int nRenderFrame, int iLeaf )
+{
+	return (int64)( ( (uint64)(uint32)nRenderFrame << 32 ) | (uint32)iLeaf );
+}
+
 //-----------------------------------------------------------------------------
 // The client leaf system
 //-----------------------------------------------------------------------------
@@ -112,6 +137,7 @@ public:
 	virtual void CollateViewModelRenderables( CUtlVector< IClientRenderable * >& opaque, CUtlVector< IClientRenderable * >& translucent );
 	virtual void BuildRenderablesList( const SetupRenderInfo_t &info );
 			void CollateRenderablesInLeaf( int leaf, int worldListLeafIndex, const SetupRenderInfo_t &info );
+			void ReplayRecordedRenderablesList( int nIterations );
 	virtual void DrawStaticProps( bool enable );
 	virtual void DrawSmallEntities( bool enable );
 	virtual void EnableAlternateSorting( ClientRenderHandle_t handle, bool bEnable );
@@ -156,6 +182,14 @@ private:
 
 	void SortEntities(  const Vector &vecRenderOrigin, const Vector &vecRenderForward, CClientRenderablesList::CEntry *pEntities, int nEntities );
 
+	// Collates a leaf into either the final render list or a job's private lists
+	template< class BUILDER > void CollateRenderablesInLeafEx( int leaf, int worldListLeafIndex, const SetupRenderInfo_t &info, BUILDER &builder );
+
+	// Serial and threaded versions of BuildRenderablesList
+	void BuildRenderablesListSerial( const SetupRenderInfo_t &info );
+	void BuildRenderablesListThreaded( const SetupRenderInfo_t &info );
+	void BuildRenderablesListJob( RenderListJob_t &job );
+
 	// Returns -1 if the renderable spans more than one area. If it's totally in one area, then this returns the leaf.
 	short GetRenderableArea( ClientRenderHandle_t handle );
 
@@ -238,6 +272,7 @@ private:
 		RENDER_FLAGS_STUDIO_MODEL	= 0x08,
 		RENDER_FLAGS_HASCHANGED		= 0x10,
 		RENDER_FLAGS_ALTERNATE_SORTING = 0x20,
+		RENDER_FLAGS_LOOSE_BOUNDS	= 0x40,	// m_vecLooseMins/Maxs hold the box it was last placed in the leaves with
 	};
 
 	// All the information associated with a particular handle
@@ -255,6 +290,9 @@ private:
 		unsigned short		m_FirstShadow;	// The first shadow caster that cast on it
 		short m_Area;	// -1 if the renderable spans multiple areas.
 		signed char			m_TranslucencyCalculatedView;
+		ALIGN8 int64		m_VisitStamp ALIGN8_POST;	// Render frame + world list leaf that claimed it in a threaded build
+		Vector				m_vecLooseMins;	// Expanded world space box used for the leaf enumeration
+		Vector				m_vecLooseMaxs;
 	};
 
 	// The leaf contains an index into a list of renderables
@@ -324,6 +362,9 @@ private:
 	int	m_ShadowEnum;
 
 	CTSList<EnumResultList_t> m_DeferredInserts;
+
+	// Per-job lists for the threaded BuildRenderablesList
+	CUtlVector< RenderListJob_t > m_RenderListJobs;
 };
 
 
@@ -521,6 +562,16 @@ void CClientLeafSystem::LevelShutdownPostEntity()
 }
 
 
+//-----------------------------------------------------------------------------
+// Returns true if a renderable's box still fits in the box it was placed in the leaves with
+//-----------------------------------------------------------------------------
+static inline bool IsBoxInsideLooseBounds( const Vector &absMins, const Vector &absMaxs, const Vector &looseMins, const Vector &looseMaxs )
+{
+	return ( absMins.x >= looseMins.x ) && ( absMins.y >= looseMins.y ) && ( absMins.z >= looseMins.z ) &&
+		( absMaxs.x <= looseMaxs.x ) && ( absMaxs.y <= looseMaxs.y ) && ( absMaxs.z <= looseMaxs.z );
+}
+
+
 //-----------------------------------------------------------------------------
 // This is what happens before rendering a particular view
 //-----------------------------------------------------------------------------
@@ -540,30 +591,53 @@ void CClientLeafSystem::PreRender()
 		}
 
 		int nDirty = m_DirtyRenderables.Count();
+
+		// InsertIntoTree can result in new renderables being added, so copy the ones that need to move:
+		ClientRenderHandle_t *pReinsert = (ClientRenderHandle_t *)stackalloc( sizeof(ClientRenderHandle_t) * nDirty );
+		int nReinsert = 0;
+
+		float flBuffer = cl_leafsystem_aabb_buffer.GetFloat();
+		Vector vecBuffer( flBuffer, flBuffer, flBuffer );
 		for ( i = nDirty; --i >= 0; )
 		{
 			ClientRenderHandle_t handle = m_DirtyRenderables[i];
-			Assert( m_Renderables[ handle ].m_Flags & RENDER_FLAGS_HASCHANGED );
+			RenderableInfo_t& renderable = m_Renderables[ handle ];
+			Assert( renderable.m_Flags & RENDER_FLAGS_HASCHANGED );
+
+			Vector absMins, absMaxs;
+			CalcRenderableWorldSpaceAABB_Fast( renderable.m_pRenderable, absMins, absMaxs );
+			Assert( absMins.IsValid() && absMaxs.IsValid() );
+
+			// If it's still inside the box it was placed with, it's still in the same leaves.
+			// Brush models always reinsert since the shadows projected onto them depend on where they are.
+			if ( ( flBuffer > 0.0f ) && ( renderable.m_Flags & RENDER_FLAGS_LOOSE_BOUNDS ) && !( renderable.m_Flags & RENDER_FLAGS_BRUSH_MODEL ) &&
+				IsBoxInsideLooseBounds( absMins, absMaxs, renderable.m_vecLooseMins, renderable.m_vecLooseMaxs ) )
+			{
+				renderable.m_Flags &= ~RENDER_FLAGS_HASCHANGED;
+				continue;
+			}
+
+			VectorSubtract( absMins, vecBuffer, renderable.m_vecLooseMins );
+			VectorAdd( absMaxs, vecBuffer, renderable.m_vecLooseMaxs );
+			renderable.m_Flags |= RENDER_FLAGS_LOOSE_BOUNDS;
 
 			// Update position in leaf system
 			RemoveFromTree( handle );
+			pReinsert[nReinsert++] = handle;
 		}
 
-		bool bThreaded = false;//( nDirty > 5 && cl_threaded_client_leaf_system.GetBool() && g_pThreadPool->NumThreads() );
+		bool bThreaded = ( nReinsert >= MIN_THREADED_REINSERTS && cl_threaded_client_leaf_system.GetBool() && g_pThreadPool->NumThreads() );
 
 		if ( !bThreaded )
 		{
-			for ( i = nDirty; --i >= 0; )
+			for ( i = nReinsert; --i >= 0; )
 			{
-				InsertIntoTree( m_DirtyRenderables[i] );
+				InsertIntoTree( pReinsert[i] );
 			}
 		}
 		else
 		{
-			// InsertIntoTree can result in new renderables being added, so copy:
-			ClientRenderHandle_t *pDirtyRenderables = (ClientRenderHandle_t *)alloca( sizeof(ClientRenderHandle_t) * nDirty );
-			memcpy( pDirtyRenderables, m_DirtyRenderables.Base(), sizeof(ClientRenderHandle_t) * nDirty );
-			ParallelProcess( "CClientLeafSystem::PreRender", pDirtyRenderables, nDirty, this, &CClientLeafSystem::InsertIntoTree, &CClientLeafSystem::FrameLock, &CClientLeafSystem::FrameUnlock );
+			ParallelProcess( "CClientLeafSystem::PreRender", pReinsert, nReinsert, this, &CClientLeafSystem::InsertIntoTree, &CClientLeafSystem::FrameLock, &CClientLeafSystem::FrameUnlock );
 		}
 
 		if ( m_DeferredInserts.Count() )
@@ -588,6 +662,10 @@ void CClientLeafSystem::PreRender()
 			ClientRenderHandle_t handle = m_DirtyRenderables[i];
 			RenderableInfo_t& renderable = m_Renderables[ handle ];
 
+			// Renderables that stayed in their leaves keep their area
+			if ( ( renderable.m_Flags & RENDER_FLAGS_HASCHANGED ) == 0 )
+				continue;
+
 			renderable.m_Flags &= ~RENDER_FLAGS_HASCHANGED;
 			m_Renderables[handle].m_Area = GetRenderableArea( handle );
 		}
@@ -622,6 +700,7 @@ void CClientLeafSystem::NewRenderable( IClientRenderable* pRenderable, RenderGro
 	info.m_pRenderable = pRenderable;
 	info.m_RenderFrame = -1;
 	info.m_RenderFrame2 = -1;
+	info.m_VisitStamp = RenderListVisitStamp( -1, 0 );
 	info.m_TranslucencyCalculated = -1;
 	info.m_TranslucencyCalculatedView = VIEW_ILLEGAL;
 	info.m_FirstShadow = m_ShadowsOnRenderable.InvalidIndex();
@@ -1160,15 +1239,12 @@ void CClientLeafSystem::InsertIntoTree( ClientRenderHandle_t &handle )
 
 	EnumResultList_t list = { NULL, handle };
 
-	// NOTE: The render bounds here are relative to the renderable's coordinate system
-	IClientRenderable* pRenderable = m_Renderables[handle].m_pRenderable;
-	Vector absMins, absMaxs;
-	
-	CalcRenderableWorldSpaceAABB_Fast( pRenderable, absMins, absMaxs );
-	Assert( absMins.IsValid() && absMaxs.IsValid() );
+	// NOTE: PreRender has already computed the world space box, expanded by cl_leafsystem_aabb_buffer
+	const RenderableInfo_t &renderable = m_Renderables[handle];
+	Assert( renderable.m_Flags & RENDER_FLAGS_LOOSE_BOUNDS );
 
 	ISpatialQuery* pQuery = engine->GetBSPTreeQuery();
-	pQuery->EnumerateLeavesInBox( absMins, absMaxs, this, (int)&list );
+	pQuery->EnumerateLeavesInBox( renderable.m_vecLooseMins, renderable.m_vecLooseMaxs, this, (int)&list );
 
 	if ( list.pHead )
 	{
@@ -1440,6 +1516,80 @@ inline void AddRenderableToRenderList( CClientRenderablesList &renderList, IClie
 }
 
 
+//-----------------------------------------------------------------------------
+// Destinations for CollateRenderablesInLeafEx. The serial builder writes
+// straight into the render list and dedupes on the render frame. The job
+// builder writes into a job's private lists and dedupes on an atomic visit
+// stamp, keeping the lowest world list leaf no matter which job gets there first.
+//-----------------------------------------------------------------------------
+class CRenderListBuilder
+{
+public:
+	CRenderListBuilder( CClientRenderablesList &renderList ) : m_RenderList( renderList ) {}
+
+	bool MarkVisited( int &nRenderFrame2, int64 volatile &nVisitStamp, int nRenderFrame, int iLeaf )
+	{
+		if ( nRenderFrame2 == nRenderFrame )
+			return false;
+
+		nRenderFrame2 = nRenderFrame;
+		return true;
+	}
+
+	void Add( IClientRenderable *pRenderable, int iLeaf, RenderGroup_t group, ClientRenderHandle_t renderHandle, bool bTwoPass = false )
+	{
+		AddRenderableToRenderList( m_RenderList, pRenderable, iLeaf, group, renderHandle, bTwoPass );
+	}
+
+private:
+	CClientRenderablesList &m_RenderList;
+};
+
+class CRenderListJobBuilder
+{
+public:
+	CRenderListJobBuilder( RenderListJob_t &job ) : m_Job( job ) {}
+
+	bool MarkVisited( int &nRenderFrame2, int64 volatile &nVisitStamp, int nRenderFrame, int iLeaf )
+	{
+		int64 nStamp = RenderListVisitStamp( nRenderFrame, iLeaf );
+		for ( ;; )
+		{
+			// A plain 64-bit load can tear on 32-bit builds, so read through the interlocked op
+			int64 nOldStamp = ThreadInterlockedCompareExchange64( &nVisitStamp, 0, 0 );
+			if ( ( nOldStamp >> 32 ) == ( nStamp >> 32 ) && (uint32)nOldStamp <= (uint32)nStamp )
+				return false;
+
+			if ( ThreadInterlockedAssignIf64( &nVisitStamp, nStamp, nOldStamp ) )
+				return true;
+		}
+	}
+
+	void Add( IClientRenderable *pRenderable, int iLeaf, RenderGroup_t group, ClientRenderHandle_t renderHandle, bool bTwoPass = false )
+	{
+#ifdef _DEBUG
+		if (cl_drawleaf.GetInt() >= 0)
+		{
+			if (iLeaf != cl_drawleaf.GetInt())
+				return;
+		}
+#endif
+
+		Assert( group >= 0 && group < RENDER_GROUP_COUNT );
+		Assert( (iLeaf >= 0) && (iLeaf <= 65535) );
+
+		CClientRenderablesList::CEntry &entry = m_Job.m_RenderGroups[group][ m_Job.m_RenderGroups[group].AddToTail() ];
+		entry.m_pRenderable = pRenderable;
+		entry.m_iWorldListInfoLeaf = iLeaf;
+		entry.m_TwoPass = bTwoPass;
+		entry.m_RenderHandle = renderHandle;
+	}
+
+private:
+	RenderListJob_t &m_Job;
+};
+
+
 //-----------------------------------------------------------------------------
 // Purpose: 
 // Input  : renderList - 
@@ -1504,12 +1654,19 @@ static RenderGroup_t DetectBucketedRenderGroup( RenderGroup_t group, float fDime
 }
 
 void CClientLeafSystem::CollateRenderablesInLeaf( int leaf, int worldListLeafIndex,	const SetupRenderInfo_t &info )
+{
+	CRenderListBuilder builder( *info.m_pRenderList );
+	CollateRenderablesInLeafEx( leaf, worldListLeafIndex, info, builder );
+}
+
+template< class BUILDER >
+void CClientLeafSystem::CollateRenderablesInLeafEx( int leaf, int worldListLeafIndex, const SetupRenderInfo_t &info, BUILDER &builder )
 {
 	bool portalTestEnts = r_PortalTestEnts.GetBool() && !r_portalsopenall.GetBool();
 	
 	// Place a fake entity for static/opaque ents in this leaf
-	AddRenderableToRenderList( *info.m_pRenderList, NULL, worldListLeafIndex, RENDER_GROUP_OPAQUE_STATIC, NULL );
-	AddRenderableToRenderList( *info.m_pRenderList, NULL, worldListLeafIndex, RENDER_GROUP_OPAQUE_ENTITY, NULL );
+	builder.Add( NULL, worldListLeafIndex, RENDER_GROUP_OPAQUE_STATIC, NULL );
+	builder.Add( NULL, worldListLeafIndex, RENDER_GROUP_OPAQUE_ENTITY, NULL );
 
 	// Collate everything.
 	unsigned short idx = m_RenderablesInLeaf.FirstElement(leaf);
@@ -1538,10 +1695,8 @@ void CClientLeafSystem::CollateRenderablesInLeaf( int leaf, int worldListLeafInd
 		// Don't hit the same ent in multiple leaves twice.
 		if ( renderable.m_RenderGroup != RENDER_GROUP_TRANSLUCENT_ENTITY )
 		{
-			if ( renderable.m_RenderFrame2 == info.m_nRenderFrame )
+			if ( !builder.MarkVisited( renderable.m_RenderFrame2, renderable.m_VisitStamp, info.m_nRenderFrame, worldListLeafIndex ) )
 				continue;
-
-			renderable.m_RenderFrame2 = info.m_nRenderFrame;
 		}
 		else // translucent
 		{
@@ -1625,7 +1780,7 @@ void CClientLeafSystem::CollateRenderablesInLeaf( int leaf, int worldListLeafInd
 				Assert( group >= RENDER_GROUP_OPAQUE_STATIC_HUGE && group <= RENDER_GROUP_OPAQUE_ENTITY );
 			}
 
-			AddRenderableToRenderList( *info.m_pRenderList, renderable.m_pRenderable, 
+			builder.Add( renderable.m_pRenderable, 
 				worldListLeafIndex, group, handle);
 		}
 		else
@@ -1635,13 +1790,13 @@ void CClientLeafSystem::CollateRenderablesInLeaf( int leaf, int worldListLeafInd
 			// Add to appropriate list if drawing translucent objects (shadow depth mapping will skip this)
 			if ( info.m_bDrawTranslucentObjects ) 
 			{
-				AddRenderableToRenderList( *info.m_pRenderList, renderable.m_pRenderable, 
+				builder.Add( renderable.m_pRenderable, 
 					worldListLeafIndex, (RenderGroup_t)renderable.m_RenderGroup, handle, bTwoPass );
 			}
 			
 			if ( bTwoPass )	// Also add to opaque list if it's a two-pass model... 
 			{
-				AddRenderableToRenderList( *info.m_pRenderList, renderable.m_pRenderable, 
+				builder.Add( renderable.m_pRenderable, 
 					worldListLeafIndex, RENDER_GROUP_OPAQUE_ENTITY, handle, bTwoPass );
 			}
 		}
@@ -1667,14 +1822,14 @@ void CClientLeafSystem::CollateRenderablesInLeaf( int leaf, int worldListLeafInd
 						// Lots of the detail entities are invisible so avoid sorting them and all that.
 						if( pRenderable->GetFxBlend() > 0 )
 						{
-							AddRenderableToRenderList( *info.m_pRenderList, pRenderable, 
+							builder.Add( pRenderable, 
 								worldListLeafIndex, RENDER_GROUP_TRANSLUCENT_ENTITY, DETAIL_PROP_RENDER_HANDLE );
 						}
 					}
 				}
 				else
 				{
-					AddRenderableToRenderList( *info.m_pRenderList, pRenderable, 
+					builder.Add( pRenderable, 
 						worldListLeafIndex, RENDER_GROUP_OPAQUE_ENTITY, DETAIL_PROP_RENDER_HANDLE );
 				}
 			}
@@ -1742,9 +1897,46 @@ void CClientLeafSystem::SortEntities( const Vector &vecRenderOrigin, const Vecto
 }
 
 
+//-----------------------------------------------------------------------------
+// A recorded BuildRenderablesList call, used by cl_renderlist_replay
+//-----------------------------------------------------------------------------
+struct RecordedRenderList_t
+{
+	bool m_bRecordNext;
+	bool m_bValid;
+	SetupRenderInfo_t m_Info;
+	CUtlVector< LeafIndex_t > m_Leaves;
+};
+
+static RecordedRenderList_t s_RecordedRenderList;
+
 void CClientLeafSystem::BuildRenderablesList( const SetupRenderInfo_t &info )
 {
 	VPROF_BUDGET( "BuildRenderablesList", "BuildRenderablesList" );
+
+	if ( s_RecordedRenderList.m_bRecordNext )
+	{
+		s_RecordedRenderList.m_bRecordNext = false;
+		s_RecordedRenderList.m_bValid = true;
+		s_RecordedRenderList.m_Info = info;
+		s_RecordedRenderList.m_Leaves.CopyArray( info.m_pWorldListInfo->m_pLeafList, info.m_pWorldListInfo->m_LeafCount );
+	}
+
+	bool bThreaded = ( cl_threaded_client_leaf_system.GetBool() && g_pThreadPool->NumThreads() &&
+		info.m_pWorldListInfo->m_LeafCount >= 2 * RENDER_LIST_LEAVES_PER_JOB );
+
+	if ( bThreaded )
+	{
+		BuildRenderablesListThreaded( info );
+	}
+	else
+	{
+		BuildRenderablesListSerial( info );
+	}
+}
+
+void CClientLeafSystem::BuildRenderablesListSerial( const SetupRenderInfo_t &info )
+{
 	int leafCount = info.m_pWorldListInfo->m_LeafCount;
 	const Vector &vecRenderOrigin = info.m_vecRenderOrigin;
 	const Vector &vecRenderForward = info.m_vecRenderForward;
@@ -1766,3 +1958,164 @@ void CClientLeafSystem::BuildRenderablesList( const SetupRenderInfo_t &info )
 		}
 	}
 }
+
+
+//-----------------------------------------------------------------------------
+// Collates one job's run of leaves into the job's private lists
+//-----------------------------------------------------------------------------
+void CClientLeafSystem::BuildRenderablesListJob( RenderListJob_t &job )
+{
+	const SetupRenderInfo_t &info = *job.m_pInfo;
+	CUtlVector< CClientRenderablesList::CEntry > &translucentEntries = job.m_RenderGroups[RENDER_GROUP_TRANSLUCENT_ENTITY];
+	CRenderListJobBuilder builder( job );
+
+	for( int i = job.m_nFirstLeaf; i < job.m_nFirstLeaf + job.m_nLeafCount; i++ )
+	{
+		int nTranslucent = translucentEntries.Count();
+
+		CollateRenderablesInLeafEx( info.m_pWorldListInfo->m_pLeafList[i], i, info, builder );
+
+		int nNewTranslucent = translucentEntries.Count() - nTranslucent;
+		if( (nNewTranslucent != 0 ) && info.m_bDrawTranslucentObjects )
+		{
+			SortEntities( info.m_vecRenderOrigin, info.m_vecRenderForward, &translucentEntries[nTranslucent], nNewTranslucent );
+		}
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Collates the leaves on the job threads, then merges the job lists in leaf
+// order so the result is identical to BuildRenderablesListSerial
+//-----------------------------------------------------------------------------
+void CClientLeafSystem::BuildRenderablesListThreaded( const SetupRenderInfo_t &info )
+{
+	int leafCount = info.m_pWorldListInfo->m_LeafCount;
+	int nJobs = ( leafCount + RENDER_LIST_LEAVES_PER_JOB - 1 ) / RENDER_LIST_LEAVES_PER_JOB;
+	m_RenderListJobs.EnsureCount( nJobs );
+
+	int i;
+	for ( i = 0; i < nJobs; i++ )
+	{
+		RenderListJob_t &job = m_RenderListJobs[i];
+		job.m_pInfo = &info;
+		job.m_nFirstLeaf = i * RENDER_LIST_LEAVES_PER_JOB;
+		job.m_nLeafCount = MIN( RENDER_LIST_LEAVES_PER_JOB, leafCount - job.m_nFirstLeaf );
+	}
+
+	ParallelProcess( "CClientLeafSystem::BuildRenderablesList", m_RenderListJobs.Base(), nJobs, this, &CClientLeafSystem::BuildRenderablesListJob, &CClientLeafSystem::FrameLock, &CClientLeafSystem::FrameUnlock );
+
+	// A non-translucent renderable in several leaves may have been collected by
+	// more than one job; only the entry from the leaf holding the stamp is kept.
+	for ( i = 0; i < nJobs; i++ )
+	{
+		RenderListJob_t &job = m_RenderListJobs[i];
+		for ( int nGroup = 0; nGroup < RENDER_GROUP_COUNT; nGroup++ )
+		{
+			CUtlVector< CClientRenderablesList::CEntry > &entries = job.m_RenderGroups[nGroup];
+			for ( int j = 0; j < entries.Count(); j++ )
+			{
+				const CClientRenderablesList::CEntry &entry = entries[j];
+				if ( entry.m_pRenderable && entry.m_RenderHandle != DETAIL_PROP_RENDER_HANDLE )
+				{
+					const RenderableInfo_t &renderable = m_Renderables[entry.m_RenderHandle];
+					if ( ( renderable.m_RenderGroup != RENDER_GROUP_TRANSLUCENT_ENTITY ) &&
+						 ( renderable.m_VisitStamp != RenderListVisitStamp( info.m_nRenderFrame, entry.m_iWorldListInfoLeaf ) ) )
+						continue;
+				}
+
+				AddRenderableToRenderList( *info.m_pRenderList, entry.m_pRenderable, entry.m_iWorldListInfoLeaf,
+					(RenderGroup_t)nGroup, entry.m_RenderHandle, entry.m_TwoPass != 0 );
+			}
+			entries.RemoveAll();
+		}
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Rebuilds the recorded render list both ways against the current renderables,
+// checks the results match and reports the timings
+//-----------------------------------------------------------------------------
+static bool RenderListsMatch( const CClientRenderablesList &a, const CClientRenderablesList &b )
+{
+	for ( int nGroup = 0; nGroup < RENDER_GROUP_COUNT; nGroup++ )
+	{
+		if ( a.m_RenderGroupCounts[nGroup] != b.m_RenderGroupCounts[nGroup] )
+			return false;
+
+		for ( int i = 0; i < a.m_RenderGroupCounts[nGroup]; i++ )
+		{
+			const CClientRenderablesList::CEntry &entryA = a.m_RenderGroups[nGroup][i];
+			const CClientRenderablesList::CEntry &entryB = b.m_RenderGroups[nGroup][i];
+			if ( ( entryA.m_pRenderable != entryB.m_pRenderable ) || ( entryA.m_iWorldListInfoLeaf != entryB.m_iWorldListInfoLeaf ) ||
+				 ( entryA.m_TwoPass != entryB.m_TwoPass ) || ( entryA.m_RenderHandle != entryB.m_RenderHandle ) )
+				return false;
+		}
+	}
+	return true;
+}
+
+void CClientLeafSystem::ReplayRecordedRenderablesList( int nIterations )
+{
+	if ( !s_RecordedRenderList.m_bValid )
+	{
+		Msg( "No recorded render list, use cl_renderlist_record first.\n" );
+		return;
+	}
+
+	// Replays use their own render frames so they never collide with a real view's
+	static int s_nReplayRenderFrame = INT_MIN / 2;
+
+	WorldListInfo_t worldListInfo;
+	worldListInfo.m_ViewFogVolume = -1;
+	worldListInfo.m_LeafCount = s_RecordedRenderList.m_Leaves.Count();
+	worldListInfo.m_pLeafList = s_RecordedRenderList.m_Leaves.Base();
+	worldListInfo.m_pLeafFogVolume = NULL;
+
+	CClientRenderablesList *pSerialList = new CClientRenderablesList;
+	CClientRenderablesList *pThreadedList = new CClientRenderablesList;
+
+	SetupRenderInfo_t info = s_RecordedRenderList.m_Info;
+	info.m_pWorldListInfo = &worldListInfo;
+
+	bool bMatch = true;
+	double flSerialTime = 0.0;
+	double flThreadedTime = 0.0;
+	for ( int i = 0; i < nIterations; i++ )
+	{
+		memset( pSerialList->m_RenderGroupCounts, 0, sizeof( pSerialList->m_RenderGroupCounts ) );
+		info.m_pRenderList = pSerialList;
+		info.m_nRenderFrame = s_nReplayRenderFrame++;
+		double flStart = Plat_FloatTime();
+		BuildRenderablesListSerial( info );
+		flSerialTime += Plat_FloatTime() - flStart;
+
+		memset( pThreadedList->m_RenderGroupCounts, 0, sizeof( pThreadedList->m_RenderGroupCounts ) );
+		info.m_pRenderList = pThreadedList;
+		info.m_nRenderFrame = s_nReplayRenderFrame++;
+		flStart = Plat_FloatTime();
+		BuildRenderablesListThreaded( info );
+		flThreadedTime += Plat_FloatTime() - flStart;
+
+		bMatch = bMatch && RenderListsMatch( *pSerialList, *pThreadedList );
+	}
+
+	Msg( "%d leaves, %d iterations: serial %.3f ms, threaded %.3f ms, lists %s\n",
+		worldListInfo.m_LeafCount, nIterations, 1000.0 * flSerialTime / nIterations, 1000.0 * flThreadedTime / nIterations,
+		bMatch ? "match" : "DIFFER" );
+
+	pSerialList->Release();
+	pThreadedList->Release();
+}
+
+CON_COMMAND_F( cl_renderlist_record, "Records the leaf list of the next BuildRenderablesList call for cl_renderlist_replay.", FCVAR_CHEAT )
+{
+	s_RecordedRenderList.m_bRecordNext = true;
+}
+
+CON_COMMAND_F( cl_renderlist_replay, "Rebuilds the recorded render list serially and threaded, compares the results and prints timings.", FCVAR_CHEAT )
+{
+	int nIterations = ( args.ArgC() > 1 ) ? MAX( atoi( args[1] ), 1 ) : 100;
+	CClientLeafSystem::s_ClientLeafSystem.ReplayRecordedRenderablesList( nIterations );
+}
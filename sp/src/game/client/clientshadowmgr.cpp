@@ -100,6 +100,10 @@ ConVar r_flashlightdepthres( "r_flashlightdepthres", "1024" );
 #endif
 
 ConVar r_threaded_client_shadow_manager( "r_threaded_client_shadow_manager", "0" );
+static ConVar r_shadow_projection_cache( "r_shadow_projection_cache", "1", FCVAR_CHEAT, "Don't reproject shadows whose caster transform, bounds, cast distance and direction haven't changed." );
+
+// Dirty shadow counts below this enumerate their leaves on the main thread even when threaded
+#define MIN_THREADED_SHADOW_LEAF_LISTS	16
 
 #ifdef _WIN32
 #pragma warning( disable: 4701 )
@@ -801,6 +805,7 @@ private:
 		SHADOW_FLAGS_BRUSH_MODEL =		(CLIENT_SHADOW_FLAGS_LAST_FLAG << 2), 
 		SHADOW_FLAGS_USING_LOD_SHADOW = (CLIENT_SHADOW_FLAGS_LAST_FLAG << 3),
 		SHADOW_FLAGS_LIGHT_WORLD =		(CLIENT_SHADOW_FLAGS_LAST_FLAG << 4),
+		SHADOW_FLAGS_PROJECTION_CACHED = (CLIENT_SHADOW_FLAGS_LAST_FLAG << 5),
 	};
 
 	struct ClientShadow_t
@@ -817,6 +822,37 @@ private:
 		CTextureReference		m_ShadowDepthTexture;
 		int						m_nRenderFrame;
 		EHANDLE					m_hTargetEntity;
+
+		// The inputs the current projection was built from (valid with SHADOW_FLAGS_PROJECTION_CACHED)
+		Vector					m_ProjectionOrigin;
+		QAngle					m_ProjectionAngles;
+		Vector					m_ProjectionDir;
+		Vector					m_ProjectionMins;
+		Vector					m_ProjectionMaxs;
+		float					m_flProjectionDist;
+		ShadowType_t			m_nProjectionType;
+	};
+
+	// A shadow projection waiting for its leaf list before it's handed to the engine
+	struct ShadowProjection_t
+	{
+		ClientShadowHandle_t	m_Handle;
+		IClientRenderable		*m_pRenderable;
+		Vector					m_vecOrigin;
+		Vector					m_vecDir;
+		VMatrix					m_WorldToTexture;
+		Vector2D				m_Size;
+		float					m_flMaxHeight;
+		float					m_flFalloffStart;
+
+		// Render-to-texture shadows also get extra clip planes
+		bool					m_bExtraClipPlanes;
+		Vector					m_vecBasis[3];
+		Vector					m_vecMins;
+		Vector					m_vecMaxs;
+		Vector					m_vecLocalShadowDir;
+
+		CUtlVector< int >		m_LeafList;
 	};
 
 private:
@@ -845,6 +881,19 @@ private:
 	// Update a shadow
 	void UpdateProjectedTextureInternal( ClientShadowHandle_t handle, bool force );
 
+	// Returns true if the shadow was last projected from exactly these inputs, otherwise records them
+	bool IsShadowProjectionCurrent( IClientRenderable *pRenderable, ClientShadowHandle_t handle,
+		const Vector &mins, const Vector &maxs, ShadowType_t shadowType );
+	void InvalidateShadowProjection( ClientShadowHandle_t handle );
+
+	// Shadow projections are either finished immediately or, while updating dirty
+	// shadows on multiple threads, queued so their leaf lists can be built in parallel
+	ShadowProjection_t &AllocShadowProjection();
+	void SubmitShadowProjection( ShadowProjection_t &projection );
+	void BuildShadowProjectionLeafList( ShadowProjection_t &projection );
+	void FinishShadowProjection( ShadowProjection_t &projection );
+	void FlushShadowProjections();
+
 	// Compute the shadow origin and attenuation start distance
 	float ComputeLocalShadowOrigin( IClientRenderable* pRenderable, 
 		const Vector& mins, const Vector& maxs, const Vector& localShadowDir, float backupFactor, Vector& origin );
@@ -958,11 +1007,17 @@ private:
 	bool m_bRenderTargetNeedsClear;
 	bool m_bUpdatingDirtyShadows;
 	bool m_bThreaded;
+	bool m_bDeferShadowProjections;
 	float m_flShadowCastDist;
 	float m_flMinShadowArea;
 	CUtlRBTree< ClientShadowHandle_t, unsigned short >	m_DirtyShadows;
 	CUtlVector< ClientShadowHandle_t > m_TransparentShadows;
 
+	// Projections queued while m_bDeferShadowProjections is set; entries past the count keep their allocations
+	CUtlVector< ShadowProjection_t > m_PendingProjections;
+	int m_nPendingProjections;
+	ShadowProjection_t m_ImmediateProjection;
+
 	// These members maintain current state of depth texturing (size and global active state)
 	// If either changes in a frame, PreRender() will catch it and do the appropriate allocation, deallocation or reallocation
 	bool m_bDepthTextureActive;
@@ -1172,6 +1227,8 @@ CClientShadowMgr::CClientShadowMgr() :
 {
 	m_nDepthTextureResolution = r_flashlightdepthres.GetInt();
 	m_bThreaded = false;
+	m_bDeferShadowProjections = false;
+	m_nPendingProjections = 0;
 }
 
 
@@ -1434,6 +1491,7 @@ void CClientShadowMgr::InitRenderToTextureShadows()
 		for (ClientShadowHandle_t i = m_Shadows.Head(); i != m_Shadows.InvalidIndex(); i = m_Shadows.Next(i) )
 		{
 			ClientShadow_t& shadow = m_Shadows[i];
+			InvalidateShadowProjection( i );
 			if ( shadow.m_Flags & SHADOW_FLAGS_USE_RENDER_TO_TEXTURE )
 			{
 				SetupRenderToTextureShadow( i );
@@ -1460,6 +1518,7 @@ void CClientShadowMgr::ShutdownRenderToTextureShadows()
 			shadowmgr->SetShadowMaterial( shadow.m_ShadowHandle, m_SimpleShadow, m_SimpleShadow, (void*)CLIENTSHADOW_INVALID_HANDLE );
 			shadowmgr->SetShadowTexCoord( shadow.m_ShadowHandle, 0, 0, 1, 1 );
 			ClearExtraClipPlanes( i );
+			InvalidateShadowProjection( i );
 		}
 
 		m_RenderShadow.Shutdown();
@@ -1654,8 +1713,13 @@ void CClientShadowMgr::UpdateAllShadows()
 //-----------------------------------------------------------------------------
 void CClientShadowMgr::SetShadowDirection( const Vector& dir )
 {
-	VectorCopy( dir, m_SimpleShadowDir );
-	VectorNormalize( m_SimpleShadowDir );
+	// shadow_control sets this on every network update; only reproject when it really changes
+	Vector vecNewDir = dir;
+	VectorNormalize( vecNewDir );
+	if ( vecNewDir == m_SimpleShadowDir )
+		return;
+
+	VectorCopy( vecNewDir, m_SimpleShadowDir );
 
 	if ( m_RenderToTextureActive )
 	{
@@ -1704,6 +1768,9 @@ const Vector &CClientShadowMgr::GetShadowDirection( IClientRenderable *pRenderab
 //-----------------------------------------------------------------------------
 void CClientShadowMgr::SetShadowDistance( float flMaxDistance )
 {
+	if ( flMaxDistance == m_flShadowCastDist )
+		return;
+
 	m_flShadowCastDist = flMaxDistance;
 	UpdateAllShadows();
 }
@@ -2257,7 +2324,7 @@ public:
 //-----------------------------------------------------------------------------
 // Builds a list of leaves inside the shadow volume
 //-----------------------------------------------------------------------------
-static void BuildShadowLeafList( CShadowLeafEnum *pEnum, const Vector& origin, 
+static void BuildShadowLeafList( ISpatialLeafEnumerator *pEnum, const Vector& origin, 
 	const Vector& dir, const Vector2D& size, float maxDist )
 {
 	Ray_t ray;
@@ -2362,21 +2429,22 @@ void CClientShadowMgr::BuildOrthoShadow( IClientRenderable* pRenderable,
 	float flShadowCastDistance = GetShadowDistance( pRenderable );
 	float maxHeight = flShadowCastDistance + falloffStart; //3.0f * sqrt( shadowArea );
 
-	CShadowLeafEnum leafList;
-	BuildShadowLeafList( &leafList, worldOrigin, vecShadowDir, size, maxHeight );
-	int nCount = leafList.m_LeafList.Count();
-	const int *pLeafList = leafList.m_LeafList.Base();
-
-	shadowmgr->ProjectShadow( m_Shadows[handle].m_ShadowHandle, worldOrigin,
-		vecShadowDir, matWorldToTexture, size, nCount, pLeafList, maxHeight, falloffStart, MAX_FALLOFF_AMOUNT, pRenderable->GetRenderOrigin() );
+	ShadowProjection_t &projection = AllocShadowProjection();
+	projection.m_Handle = handle;
+	projection.m_pRenderable = pRenderable;
+	projection.m_vecOrigin = worldOrigin;
+	projection.m_vecDir = vecShadowDir;
+	projection.m_WorldToTexture = matWorldToTexture;
+	projection.m_Size = size;
+	projection.m_flMaxHeight = maxHeight;
+	projection.m_flFalloffStart = falloffStart;
 
 	// Compute extra clip planes to prevent poke-thru
 // FIXME!!!!!!!!!!!!!!  Removing this for now since it seems to mess up the blobby shadows.
 //	ComputeExtraClipPlanes( pEnt, handle, vec, mins, maxs, localShadowDir );
+	projection.m_bExtraClipPlanes = false;
 
-	// Add the shadow to the client leaf system so it correctly marks 
-	// leafs as being affected by a particular shadow
-	ClientLeafSystem()->ProjectShadow( m_Shadows[handle].m_ClientLeafShadowHandle, nCount, pLeafList );
+	SubmitShadowProjection( projection );
 }
 
 
@@ -2542,22 +2610,120 @@ void CClientShadowMgr::BuildRenderToTextureShadow( IClientRenderable* pRenderabl
 	float flShadowCastDistance = GetShadowDistance( pRenderable );
 	float maxHeight = flShadowCastDistance + falloffStart; //3.0f * sqrt( shadowArea );
 
-	CShadowLeafEnum leafList;
-	BuildShadowLeafList( &leafList, worldOrigin, vecShadowDir, size, maxHeight );
-	int nCount = leafList.m_LeafList.Count();
-	const int *pLeafList = leafList.m_LeafList.Base();
-
-	shadowmgr->ProjectShadow( m_Shadows[handle].m_ShadowHandle, worldOrigin, 
-		vecShadowDir, matWorldToTexture, size, nCount, pLeafList, maxHeight, falloffStart, MAX_FALLOFF_AMOUNT, pRenderable->GetRenderOrigin() );
+	ShadowProjection_t &projection = AllocShadowProjection();
+	projection.m_Handle = handle;
+	projection.m_pRenderable = pRenderable;
+	projection.m_vecOrigin = worldOrigin;
+	projection.m_vecDir = vecShadowDir;
+	projection.m_WorldToTexture = matWorldToTexture;
+	projection.m_Size = size;
+	projection.m_flMaxHeight = maxHeight;
+	projection.m_flFalloffStart = falloffStart;
 
 	// Compute extra clip planes to prevent poke-thru
-	ComputeExtraClipPlanes( pRenderable, handle, vec, mins, maxs, localShadowDir );
+	projection.m_bExtraClipPlanes = true;
+	projection.m_vecBasis[0] = vec[0];
+	projection.m_vecBasis[1] = vec[1];
+	projection.m_vecBasis[2] = vec[2];
+	projection.m_vecMins = mins;
+	projection.m_vecMaxs = maxs;
+	projection.m_vecLocalShadowDir = localShadowDir;
+
+	SubmitShadowProjection( projection );
+}
+
+
+//-----------------------------------------------------------------------------
+// Shadow projection batching
+//-----------------------------------------------------------------------------
+CClientShadowMgr::ShadowProjection_t &CClientShadowMgr::AllocShadowProjection()
+{
+	if ( !m_bDeferShadowProjections )
+		return m_ImmediateProjection;
+
+	if ( m_nPendingProjections == m_PendingProjections.Count() )
+	{
+		m_PendingProjections.AddToTail();
+	}
+	return m_PendingProjections[ m_nPendingProjections++ ];
+}
+
+void CClientShadowMgr::SubmitShadowProjection( ShadowProjection_t &projection )
+{
+	if ( m_bDeferShadowProjections )
+		return;
+
+	BuildShadowProjectionLeafList( projection );
+	FinishShadowProjection( projection );
+}
+
+class CShadowLeafListEnum : public ISpatialLeafEnumerator
+{
+public:
+	CShadowLeafListEnum( CUtlVector< int > &leafList ) : m_LeafList( leafList ) {}
+
+	bool EnumerateLeaf( int leaf, int context )
+	{
+		m_LeafList.AddToTail( leaf );
+		return true;
+	}
+
+	CUtlVector< int > &m_LeafList;
+};
+
+// NOTE: This can be called on the job threads
+void CClientShadowMgr::BuildShadowProjectionLeafList( ShadowProjection_t &projection )
+{
+	projection.m_LeafList.RemoveAll();
+	CShadowLeafListEnum leafList( projection.m_LeafList );
+	BuildShadowLeafList( &leafList, projection.m_vecOrigin, projection.m_vecDir, projection.m_Size, projection.m_flMaxHeight );
+}
+
+void CClientShadowMgr::FinishShadowProjection( ShadowProjection_t &projection )
+{
+	ClientShadowHandle_t handle = projection.m_Handle;
+	int nCount = projection.m_LeafList.Count();
+	const int *pLeafList = projection.m_LeafList.Base();
+
+	shadowmgr->ProjectShadow( m_Shadows[handle].m_ShadowHandle, projection.m_vecOrigin, 
+		projection.m_vecDir, projection.m_WorldToTexture, projection.m_Size, nCount, pLeafList, 
+		projection.m_flMaxHeight, projection.m_flFalloffStart, MAX_FALLOFF_AMOUNT, projection.m_pRenderable->GetRenderOrigin() );
+
+	if ( projection.m_bExtraClipPlanes )
+	{
+		ComputeExtraClipPlanes( projection.m_pRenderable, handle, projection.m_vecBasis, 
+			projection.m_vecMins, projection.m_vecMaxs, projection.m_vecLocalShadowDir );
+	}
 
 	// Add the shadow to the client leaf system so it correctly marks 
 	// leafs as being affected by a particular shadow
 	ClientLeafSystem()->ProjectShadow( m_Shadows[handle].m_ClientLeafShadowHandle, nCount, pLeafList );
 }
 
+void CClientShadowMgr::FlushShadowProjections()
+{
+	if ( m_nPendingProjections == 0 )
+		return;
+
+	if ( m_nPendingProjections >= MIN_THREADED_SHADOW_LEAF_LISTS )
+	{
+		ParallelProcess( "CClientShadowMgr::BuildShadowProjectionLeafList", m_PendingProjections.Base(), m_nPendingProjections, this, &CClientShadowMgr::BuildShadowProjectionLeafList );
+	}
+	else
+	{
+		for ( int i = 0; i < m_nPendingProjections; ++i )
+		{
+			BuildShadowProjectionLeafList( m_PendingProjections[i] );
+		}
+	}
+
+	for ( int i = 0; i < m_nPendingProjections; ++i )
+	{
+		FinishShadowProjection( m_PendingProjections[i] );
+	}
+	m_nPendingProjections = 0;
+}
+
 static void LineDrawHelper( const Vector &startShadowSpace, const Vector &endShadowSpace, 
 						   const VMatrix &shadowToWorld, unsigned char r = 255, unsigned char g = 255, 
 						   unsigned char b = 255 )
@@ -2745,6 +2911,53 @@ void CClientShadowMgr::ComputeHierarchicalBounds( IClientRenderable *pRenderable
 }
 
 
+//-----------------------------------------------------------------------------
+// Shadow projection cache. A forced update (shadow direction or distance change,
+// parent shadow dirtied, etc) only needs to rebuild shadows whose inputs changed.
+//-----------------------------------------------------------------------------
+bool CClientShadowMgr::IsShadowProjectionCurrent( IClientRenderable *pRenderable, ClientShadowHandle_t handle,
+	const Vector &mins, const Vector &maxs, ShadowType_t shadowType )
+{
+	ClientShadow_t& shadow = m_Shadows[handle];
+
+	// The extra clip planes also depend on the entity's rendering clip plane, which we don't track
+	C_BaseEntity *pEntity = ClientEntityList().GetBaseEntityFromHandle( shadow.m_Entity );
+	if ( !r_shadow_projection_cache.GetBool() || ( pEntity && pEntity->m_bEnableRenderingClipPlane ) )
+	{
+		InvalidateShadowProjection( handle );
+		return false;
+	}
+
+	const Vector &vecOrigin = pRenderable->GetRenderOrigin();
+	const QAngle &angles = pRenderable->GetRenderAngles();
+	const Vector &vecDir = GetShadowDirection( pRenderable );
+	float flDist = GetShadowDistance( pRenderable );
+
+	if ( ( shadow.m_Flags & SHADOW_FLAGS_PROJECTION_CACHED ) &&
+		( shadow.m_nProjectionType == shadowType ) && ( shadow.m_flProjectionDist == flDist ) &&
+		( shadow.m_ProjectionOrigin == vecOrigin ) && ( shadow.m_ProjectionAngles == angles ) &&
+		( shadow.m_ProjectionDir == vecDir ) && ( shadow.m_ProjectionMins == mins ) && ( shadow.m_ProjectionMaxs == maxs ) )
+	{
+		return true;
+	}
+
+	shadow.m_Flags |= SHADOW_FLAGS_PROJECTION_CACHED;
+	shadow.m_nProjectionType = shadowType;
+	shadow.m_flProjectionDist = flDist;
+	shadow.m_ProjectionOrigin = vecOrigin;
+	shadow.m_ProjectionAngles = angles;
+	shadow.m_ProjectionDir = vecDir;
+	shadow.m_ProjectionMins = mins;
+	shadow.m_ProjectionMaxs = maxs;
+	return false;
+}
+
+void CClientShadowMgr::InvalidateShadowProjection( ClientShadowHandle_t handle )
+{
+	m_Shadows[handle].m_Flags &= ~SHADOW_FLAGS_PROJECTION_CACHED;
+}
+
+
 //-----------------------------------------------------------------------------
 // Shadow update functions
 //-----------------------------------------------------------------------------
@@ -2756,6 +2969,9 @@ void CClientShadowMgr::UpdateStudioShadow( IClientRenderable *pRenderable, Clien
 		ComputeHierarchicalBounds( pRenderable, mins, maxs );
 
 		ShadowType_t shadowType = GetActualShadowCastType( handle );
+		if ( IsShadowProjectionCurrent( pRenderable, handle, mins, maxs, shadowType ) )
+			return;
+
 		if ( shadowType != SHADOWS_RENDER_TO_TEXTURE )
 		{
 			BuildOrthoShadow( pRenderable, handle, mins, maxs );
@@ -2780,6 +2996,9 @@ void CClientShadowMgr::UpdateBrushShadow( IClientRenderable *pRenderable, Client
 		ComputeHierarchicalBounds( pRenderable, mins, maxs );
 
 		ShadowType_t shadowType = GetActualShadowCastType( handle );
+		if ( IsShadowProjectionCurrent( pRenderable, handle, mins, maxs, shadowType ) )
+			return;
+
 		if ( shadowType != SHADOWS_RENDER_TO_TEXTURE )
 		{
 			BuildOrthoShadow( pRenderable, handle, mins, maxs );
@@ -2928,6 +3147,10 @@ void CClientShadowMgr::PreRender()
 
 	m_bUpdatingDirtyShadows = true;
 
+	// Queue up the projections so their leaf lists can be built on the job threads
+	m_bDeferShadowProjections = ( r_threaded_client_shadow_manager.GetBool() && g_pThreadPool->NumThreads() && 
+		m_DirtyShadows.Count() >= MIN_THREADED_SHADOW_LEAF_LISTS );
+
 	unsigned short i = m_DirtyShadows.FirstInorder();
 	while ( i != m_DirtyShadows.InvalidIndex() )
 	{
@@ -2939,6 +3162,12 @@ void CClientShadowMgr::PreRender()
 	}
 	m_DirtyShadows.RemoveAll();
 
+	if ( m_bDeferShadowProjections )
+	{
+		FlushShadowProjections();
+		m_bDeferShadowProjections = false;
+	}
+
 	// Transparent shadows must remain dirty, since they were not re-projected
 	int nCount = m_TransparentShadows.Count();
 	for ( int i = 0; i < nCount; ++i )
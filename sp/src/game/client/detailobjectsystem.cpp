@@ -36,6 +36,7 @@
 #endif
 
 #include "materialsystem/imaterialsystemhardwareconfig.h"
+#include "vstdlib/jobthread.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -50,6 +51,11 @@ struct model_t;
 
 ConVar cl_detaildist( "cl_detaildist", "1200", 0, "Distance at which detail props are no longer visible" );
 ConVar cl_detailfade( "cl_detailfade", "400", 0, "Distance across which detail props fade in" );
+ConVar cl_detail_threaded_build( "cl_detail_threaded_build", "1", 0, "Build out and sort fast detail sprites for all visible leaves on worker threads" );
+
+// Below this many sprites in view it's not worth farming the buildout out to the job threads
+#define MIN_THREADED_DETAIL_SPRITES	2048
+
 #if defined( USE_DETAIL_SHAPES ) 
 ConVar cl_detail_max_sway( "cl_detail_max_sway", "0", FCVAR_ARCHIVE, "Amplitude of the detail prop sway" );
 ConVar cl_detail_avoid_radius( "cl_detail_avoid_radius", "0", FCVAR_ARCHIVE, "radius around detail sprite to avoid players" );
@@ -428,11 +434,25 @@ private:
 		float m_flDistance;
 	};
 
+	// One leaf's worth of sprites to build out on a job thread
+	struct SpriteBuildJob_t
+	{
+		CFastDetailLeafSpriteList *m_pData;
+		SortInfo_t *m_pSortInfo;
+		FastSpriteQuadBuildoutBufferX4_t *m_pBuildout;
+		int m_nCount;
+	};
+
 	int BuildOutSortedSprites( CFastDetailLeafSpriteList *pData,
 							   Vector const &viewOrigin,
 							   Vector const &viewForward,
 							   Vector const &viewRight,
-							   Vector const &viewUp );
+							   Vector const &viewUp,
+							   SortInfo_t *pSortInfoOut,
+							   FastSpriteQuadBuildoutBufferX4_t *pBuildoutOut );
+
+	bool BuildOutSortedSpritesThreaded( const Vector &viewOrigin, const Vector &viewForward, const Vector &viewRight, const Vector &viewUp, int nLeafCount, LeafIndex_t const * pLeafList, int nQuadCount );
+	static void ProcessSpriteBuildJob( SpriteBuildJob_t &job );
 
 	void RenderFastSprites( const Vector &viewOrigin, const Vector &viewForward, const Vector &viewRight, const Vector &viewUp, int nLeafCount, LeafIndex_t const * pLeafList );
 
@@ -486,6 +506,16 @@ private:
 	SortInfo_t *m_pFastSortInfo;
 	FastSpriteQuadBuildoutBufferX4_t *m_pBuildoutBuffer;
 
+	// Buffers for building out every visible leaf at once, laid out leaf after leaf
+	CUtlVector<SpriteBuildJob_t> m_SpriteBuildJobs;
+	SortInfo_t *m_pThreadedSortInfo;
+	FastSpriteQuadBuildoutBufferX4_t *m_pThreadedBuildoutBuffer;
+	int m_nThreadedBufferSIMDSprites;
+	Vector m_vecJobViewOrigin;
+	Vector m_vecJobViewForward;
+	Vector m_vecJobViewRight;
+	Vector m_vecJobViewUp;
+
 	float m_flDefaultFadeStart;
 	float m_flDefaultFadeEnd;
 
@@ -1402,6 +1432,9 @@ CDetailObjectSystem::CDetailObjectSystem() : m_DetailSpriteDict( 0, 32 ), m_Deta
 	m_pSortInfo = NULL;
 	m_pFastSortInfo = NULL;
 	m_pBuildoutBuffer = NULL;
+	m_pThreadedSortInfo = NULL;
+	m_pThreadedBuildoutBuffer = NULL;
+	m_nThreadedBufferSIMDSprites = 0;
 }
 
 void CDetailObjectSystem::FreeSortBuffers( void )
@@ -1421,6 +1454,18 @@ void CDetailObjectSystem::FreeSortBuffers( void )
 		MemAlloc_FreeAligned(  m_pBuildoutBuffer );
 		m_pBuildoutBuffer = NULL;
 	}
+	if ( m_pThreadedSortInfo )
+	{
+		MemAlloc_FreeAligned( m_pThreadedSortInfo );
+		m_pThreadedSortInfo = NULL;
+	}
+	if ( m_pThreadedBuildoutBuffer )
+	{
+		MemAlloc_FreeAligned( m_pThreadedBuildoutBuffer );
+		m_pThreadedBuildoutBuffer = NULL;
+	}
+	m_nThreadedBufferSIMDSprites = 0;
+	m_SpriteBuildJobs.Purge();
 }
 
 CDetailObjectSystem::~CDetailObjectSystem()
@@ -2132,13 +2177,15 @@ int CDetailObjectSystem::BuildOutSortedSprites( CFastDetailLeafSpriteList *pData
 												Vector const &viewOrigin,
 												Vector const &viewForward,
 												Vector const &viewRight,
-												Vector const &viewUp )
+												Vector const &viewUp,
+												SortInfo_t *pSortInfoOut,
+												FastSpriteQuadBuildoutBufferX4_t *pBuildoutOut )
 {
 	// part 1 - do all vertex math, fading, etc into a buffer, using as much simd as we can
 	int nSIMDSprites = pData->m_nNumSIMDSprites;
 	FastSpriteX4_t const *pSprites = pData->m_pSprites;
-	SortInfo_t *pOut = m_pFastSortInfo;
-	FastSpriteQuadBuildoutBufferX4_t *pQuadBufferOut = m_pBuildoutBuffer;
+	SortInfo_t *pOut = pSortInfoOut;
+	FastSpriteQuadBuildoutBufferX4_t *pQuadBufferOut = pBuildoutOut;
 	int curidx = 0;
 	int nLastBfMask = 0;
 
@@ -2217,7 +2264,7 @@ int CDetailObjectSystem::BuildOutSortedSprites( CFastDetailLeafSpriteList *pData
 	} while( --nSIMDSprites );
 
 	// adjust count for tail
-	int nCount = pOut - m_pFastSortInfo;
+	int nCount = pOut - pSortInfoOut;
 	if ( nLastBfMask != 0xf )						// if last not skipped
 		nCount -= ( 0 - pData->m_nNumSprites ) & 3;
 
@@ -2225,13 +2272,89 @@ int CDetailObjectSystem::BuildOutSortedSprites( CFastDetailLeafSpriteList *pData
 	if ( nCount )
 	{
 		VPROF( "CDetailObjectSystem::SortSpritesBackToFront -- Sort" );
-		std::make_heap( m_pFastSortInfo, m_pFastSortInfo + nCount, SortLessFunc ); 
-		std::sort_heap( m_pFastSortInfo, m_pFastSortInfo + nCount, SortLessFunc ); 
+		std::make_heap( pSortInfoOut, pSortInfoOut + nCount, SortLessFunc ); 
+		std::sort_heap( pSortInfoOut, pSortInfoOut + nCount, SortLessFunc ); 
 	}
 	return nCount;
 }
 
 
+void CDetailObjectSystem::ProcessSpriteBuildJob( SpriteBuildJob_t &job )
+{
+	CDetailObjectSystem &sys = s_DetailObjectSystem;
+	job.m_nCount = sys.BuildOutSortedSprites( job.m_pData, sys.m_vecJobViewOrigin, sys.m_vecJobViewForward, 
+		sys.m_vecJobViewRight, sys.m_vecJobViewUp, job.m_pSortInfo, job.m_pBuildout );
+}
+
+
+//-----------------------------------------------------------------------------
+// Builds out and sorts every visible leaf's sprites in parallel. Each leaf gets
+// its own slice of the buffers; the results are left in m_SpriteBuildJobs in
+// leaf list order. Returns false if it's not worth doing.
+//-----------------------------------------------------------------------------
+bool CDetailObjectSystem::BuildOutSortedSpritesThreaded( const Vector &viewOrigin, const Vector &viewForward, const Vector &viewRight, const Vector &viewUp, int nLeafCount, LeafIndex_t const * pLeafList, int nQuadCount )
+{
+	if ( !cl_detail_threaded_build.GetBool() || nQuadCount < MIN_THREADED_DETAIL_SPRITES )
+		return false;
+
+	m_SpriteBuildJobs.RemoveAll();
+
+	int nSIMDSprites = 0;
+	for ( int i = 0; i < nLeafCount; ++i )
+	{
+		CFastDetailLeafSpriteList *pData = reinterpret_cast<CFastDetailLeafSpriteList *> (
+			ClientLeafSystem()->GetSubSystemDataInLeaf( pLeafList[i], CLSUBSYSTEM_DETAILOBJECTS ) );
+		if ( !pData )
+			continue;
+
+		SpriteBuildJob_t &job = m_SpriteBuildJobs[ m_SpriteBuildJobs.AddToTail() ];
+		job.m_pData = pData;
+		job.m_nCount = 0;
+
+		// Stash the offsets for now, the buffers may move when they grow
+		job.m_pSortInfo = (SortInfo_t *)(intp)( nSIMDSprites * 4 );
+		job.m_pBuildout = (FastSpriteQuadBuildoutBufferX4_t *)(intp)nSIMDSprites;
+		nSIMDSprites += pData->m_nNumSIMDSprites;
+	}
+
+	if ( m_SpriteBuildJobs.Count() < 2 )
+		return false;
+
+	if ( nSIMDSprites > m_nThreadedBufferSIMDSprites )
+	{
+		if ( m_pThreadedSortInfo )
+		{
+			MemAlloc_FreeAligned( m_pThreadedSortInfo );
+		}
+		if ( m_pThreadedBuildoutBuffer )
+		{
+			MemAlloc_FreeAligned( m_pThreadedBuildoutBuffer );
+		}
+
+		m_nThreadedBufferSIMDSprites = nSIMDSprites;
+		m_pThreadedSortInfo = reinterpret_cast<SortInfo_t *> (
+			MemAlloc_AllocAligned( nSIMDSprites * 4 * sizeof( SortInfo_t ), sizeof( fltx4 ) ) );
+		m_pThreadedBuildoutBuffer = reinterpret_cast<FastSpriteQuadBuildoutBufferX4_t *> (
+			MemAlloc_AllocAligned( nSIMDSprites * sizeof( FastSpriteQuadBuildoutBufferX4_t ), sizeof( fltx4 ) ) );
+	}
+
+	for ( int i = 0; i < m_SpriteBuildJobs.Count(); ++i )
+	{
+		SpriteBuildJob_t &job = m_SpriteBuildJobs[i];
+		job.m_pSortInfo = m_pThreadedSortInfo + (intp)job.m_pSortInfo;
+		job.m_pBuildout = m_pThreadedBuildoutBuffer + (intp)job.m_pBuildout;
+	}
+
+	m_vecJobViewOrigin = viewOrigin;
+	m_vecJobViewForward = viewForward;
+	m_vecJobViewRight = viewRight;
+	m_vecJobViewUp = viewUp;
+
+	ParallelProcess( "CDetailObjectSystem::BuildOutSortedSprites", m_SpriteBuildJobs.Base(), m_SpriteBuildJobs.Count(), &ProcessSpriteBuildJob );
+	return true;
+}
+
+
 void CDetailObjectSystem::RenderFastSprites( const Vector &viewOrigin, const Vector &viewForward, const Vector &viewRight, const Vector &viewUp, int nLeafCount, LeafIndex_t const * pLeafList )
 {
 	// Here, we must draw all detail objects back-to-front
@@ -2275,6 +2398,10 @@ void CDetailObjectSystem::RenderFastSprites( const Vector &viewOrigin, const Vec
 	int nQuadsToDraw = MIN( nQuadCount, nMaxQuadsToDraw );
 	int nQuadsRemaining = nQuadsToDraw;
 
+	// With enough sprites in view, build out and sort all the leaves up front on the job threads
+	bool bPrebuilt = BuildOutSortedSpritesThreaded( viewOrigin, viewForward, viewRight, viewUp, nLeafCount, pLeafList, nQuadCount );
+	int nJob = 0;
+
 	meshBuilder.Begin( pMesh, MATERIAL_QUADS, nQuadsToDraw );
 
 
@@ -2291,12 +2418,25 @@ void CDetailObjectSystem::RenderFastSprites( const Vector &viewOrigin, const Vec
 		{
 			Assert( pData->m_nNumSprites );					// ptr with no sprites?
 
-			int nCount = BuildOutSortedSprites( pData, viewOrigin, viewForward, viewRight, viewUp );
+			int nCount;
+			SortInfo_t const *pDraw;
+			FastSpriteQuadBuildoutBufferNonSIMDView_t const *pQuadBuffer;
+			if ( bPrebuilt )
+			{
+				const SpriteBuildJob_t &job = m_SpriteBuildJobs[ nJob++ ];
+				Assert( job.m_pData == pData );
+				nCount = job.m_nCount;
+				pDraw = job.m_pSortInfo;
+				pQuadBuffer = ( FastSpriteQuadBuildoutBufferNonSIMDView_t const *) job.m_pBuildout;
+			}
+			else
+			{
+				nCount = BuildOutSortedSprites( pData, viewOrigin, viewForward, viewRight, viewUp, m_pFastSortInfo, m_pBuildoutBuffer );
+				pDraw = m_pFastSortInfo;
+				pQuadBuffer = ( FastSpriteQuadBuildoutBufferNonSIMDView_t const *) m_pBuildoutBuffer;
+			}
 
 			// part 3 - stuff the sorted sprites into the vb
-			SortInfo_t const *pDraw = m_pFastSortInfo;
-			FastSpriteQuadBuildoutBufferNonSIMDView_t const *pQuadBuffer =
-				( FastSpriteQuadBuildoutBufferNonSIMDView_t const *) m_pBuildoutBuffer;
 
 			COMPILE_TIME_ASSERT( sizeof( FastSpriteQuadBuildoutBufferNonSIMDView_t ) ==
 								 sizeof( FastSpriteQuadBuildoutBufferX4_t ) );
@@ -2475,7 +2615,7 @@ void CDetailObjectSystem::RenderFastTranslucentDetailObjectsInLeaf( const Vector
 	if ( m_nSortedFastLeaf != nLeaf )
 	{
 		m_nSortedFastLeaf = nLeaf;
-		pData->m_nNumPendingSprites = BuildOutSortedSprites( pData, viewOrigin, viewForward, viewRight, viewUp );
+		pData->m_nNumPendingSprites = BuildOutSortedSprites( pData, viewOrigin, viewForward, viewRight, viewUp, m_pFastSortInfo, m_pBuildoutBuffer );
 		pData->m_nStartSpriteIndex = 0;
 	}
 	if ( pData->m_nNumPendingSprites == 0 )
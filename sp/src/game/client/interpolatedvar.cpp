@@ -24,6 +24,7 @@ bool CInterpolationContext::s_bAllowExtrapolation = false;
 float CInterpolationContext::s_flLastTimeStamp = 0;
 
 float g_flLastPacketTimestamp = 0;
+int g_nInterpolationPrepareBatch = 1;
 
 
 ConVar cl_extrapolate_amount( "cl_extrapolate_amount", "0.25", FCVAR_CHEAT, "Set how many seconds the client will extrapolate entities for." );
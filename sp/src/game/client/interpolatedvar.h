@@ -52,6 +52,15 @@ inline void Interpolation_SetLastPacketTimeStamp( float timestamp)
 	g_flLastPacketTimestamp = timestamp;
 }
 
+// Results left by IInterpolatedVar::PrepareInterpolation() are only used while this matches
+// the batch they were computed in. Bump it to throw away every outstanding prepared value.
+extern int g_nInterpolationPrepareBatch;
+
+inline void Interpolation_FlushPrepared()
+{
+	++g_nInterpolationPrepareBatch;
+}
+
 
 // Before calling Interpolate(), you can use this use this to setup the context if 
 // you want to enable extrapolation.
@@ -164,6 +173,11 @@ public:
 	
 	// Returns 1 if the value will always be the same if currentTime is always increasing.
 	virtual int Interpolate( float currentTime ) = 0;
+
+	// Works out what Interpolate( currentTime ) will produce without touching the variable,
+	// so it can be called from a worker thread. The next Interpolate() call picks the result
+	// up as long as nothing has changed in between.
+	virtual void PrepareInterpolation( float currentTime ) = 0;
 	
 	virtual int	 GetType() const = 0;
 	virtual void RestoreToLastNetworked() = 0;
@@ -451,6 +465,7 @@ public:
 	virtual bool NoteChanged( float changetime, bool bUpdateLastNetworkedValue );
 	virtual void Reset();
 	virtual int Interpolate( float currentTime );
+	virtual void PrepareInterpolation( float currentTime );
 	virtual int GetType() const;
 	virtual void RestoreToLastNetworked();
 	virtual void Copy( IInterpolatedVar *pInSrc );
@@ -462,6 +477,7 @@ public:
 	// Just like the IInterpolatedVar functions, but you can specify an interpolation amount.
 	bool NoteChanged( float changetime, float interpolation_amount, bool bUpdateLastNetworkedValue );
 	int Interpolate( float currentTime, float interpolation_amount );
+	void PrepareInterpolation( float currentTime, float interpolation_amount );
 
 	void DebugInterpolate( Type *pOut, float currentTime );
 
@@ -522,6 +538,12 @@ protected:
 	void RemoveOldEntries( float oldesttime );
 	void RemoveEntriesPreviousTo( float flTime );
 
+	// Computes the interpolated value into pOut. Returns false if there's no history to use.
+	bool InterpolateInto( Type *pOut, float currentTime, float interpolation_amount, int *pNoMoreChanges );
+
+	// Called whenever the history or looping flags change under a prepared result.
+	void InvalidatePrepared() { m_nPreparedBatch = 0; }
+
 	bool GetInterpolationInfo( 
 		CInterpolationInfo *pInfo,
 		float currentTime, 
@@ -572,6 +594,14 @@ protected:
 	float								m_InterpolationAmount;
 	const char *						m_pDebugName;
 	bool								m_bDebug : 1;
+
+	// Output of PrepareInterpolation(), valid while m_nPreparedBatch == g_nInterpolationPrepareBatch.
+	Type *								m_PreparedValue;
+	float								m_flPreparedTime;
+	float								m_flPreparedAmount;
+	int									m_nPreparedBatch;
+	int									m_nPreparedNoMoreChanges;
+	bool								m_bPreparedHasValue;
 };
 
 
@@ -587,6 +617,12 @@ inline CInterpolatedVarArrayBase<Type, IS_ARRAY>::CInterpolatedVarArrayBase( con
 	m_LastNetworkedValue = NULL;
 	m_bLooping = NULL;
 	m_bDebug = false;
+	m_PreparedValue = NULL;
+	m_flPreparedTime = 0;
+	m_flPreparedAmount = 0;
+	m_nPreparedBatch = 0;
+	m_nPreparedNoMoreChanges = 0;
+	m_bPreparedHasValue = false;
 }
 
 template< typename Type, bool IS_ARRAY >
@@ -595,6 +631,7 @@ inline CInterpolatedVarArrayBase<Type, IS_ARRAY>::~CInterpolatedVarArrayBase()
 	ClearHistory();
 	delete [] m_bLooping;
 	delete [] m_LastNetworkedValue;
+	delete [] m_PreparedValue;
 }
 
 template< typename Type, bool IS_ARRAY >
@@ -621,6 +658,7 @@ void CInterpolatedVarArrayBase<Type, IS_ARRAY>::NoteLastNetworkedValue()
 {
 	memcpy( m_LastNetworkedValue, m_pValue, m_nMaxCount * sizeof( Type ) );
 	m_LastNetworkedTime = g_flLastPacketTimestamp;
+	InvalidatePrepared();
 }
 
 template< typename Type, bool IS_ARRAY >
@@ -693,12 +731,15 @@ inline void CInterpolatedVarArrayBase<Type, IS_ARRAY>::ClearHistory()
 		m_VarHistory[i].DeleteEntry();
 	}
 	m_VarHistory.RemoveAll();
+	InvalidatePrepared();
 }
 
 template< typename Type, bool IS_ARRAY >
 inline void CInterpolatedVarArrayBase<Type, IS_ARRAY>::AddToHead( float changeTime, const Type* values, bool bFlushNewer )
 {
 	MEM_ALLOC_CREDIT_CLASS();
+	InvalidatePrepared();
+
 	int newslot;
 	
 	if ( bFlushNewer )
@@ -775,6 +816,7 @@ inline void CInterpolatedVarArrayBase<Type, IS_ARRAY>::RemoveOldEntries( float o
 		newCount = i;
 	}
 	m_VarHistory.Truncate(newCount);
+	InvalidatePrepared();
 }
 
 
@@ -789,6 +831,7 @@ inline void CInterpolatedVarArrayBase<Type, IS_ARRAY>::RemoveEntriesPreviousTo(
 			// and the sample right before it (for hermite blending), and we can get rid
 			// of everything else.
 			m_VarHistory.Truncate( i + 3 );
+			InvalidatePrepared();
 			break;
 		}
 	}
@@ -965,34 +1008,18 @@ inline void CInterpolatedVarArrayBase<Type, IS_ARRAY>::DebugInterpolate( Type *p
 }
 
 template< typename Type, bool IS_ARRAY >
-inline int CInterpolatedVarArrayBase<Type, IS_ARRAY>::Interpolate( float currentTime, float interpolation_amount )
+inline bool CInterpolatedVarArrayBase<Type, IS_ARRAY>::InterpolateInto( Type *pOut, float currentTime, float interpolation_amount, int *pNoMoreChanges )
 {
-	int noMoreChanges = 0;
-	
 	CInterpolationInfo info;
-	if (!GetInterpolationInfo( &info, currentTime, interpolation_amount, &noMoreChanges ))
-		return noMoreChanges;
+	if (!GetInterpolationInfo( &info, currentTime, interpolation_amount, pNoMoreChanges ))
+		return false;
 
-	
 	CVarHistory &history = m_VarHistory;
 
-	if ( m_bDebug )
-	{
-		// "value will hold" means we are either extrapolating, or the samples in GetInterpolationInfo are all the same... In either case there are no more "changes" until we latch a new
-		//  value and we can remove this var from the interpolated var list (bit perf optimization)
-		Msg( "%s Interpolate at %f%s\n", GetDebugName(), currentTime, noMoreChanges ? " [value will hold]" : "" );
-	}
-
-
-#ifdef INTERPOLATEDVAR_PARANOID_MEASUREMENT
-	Type *backupValues = (Type*)_alloca( m_nMaxCount * sizeof(Type) );
-	memcpy( backupValues, m_pValue, sizeof( Type ) * m_nMaxCount );
-#endif
-
 	if ( info.m_bHermite )
 	{
 		// base cast, we have 3 valid sample point
-		_Interpolate_Hermite( m_pValue, info.frac, &history[info.oldest], &history[info.older], &history[info.newer] );
+		_Interpolate_Hermite( pOut, info.frac, &history[info.oldest], &history[info.older], &history[info.newer] );
 	}
 	else if ( info.newer == info.older  )
 	{
@@ -1021,16 +1048,72 @@ inline int CInterpolatedVarArrayBase<Type, IS_ARRAY>::Interpolate( float current
 			// The End
 
 			// Use the velocity here (extrapolate up to 1/4 of a second).
-			_Extrapolate( m_pValue, &history[realOlder], &history[info.newer], currentTime - interpolation_amount, cl_extrapolate_amount.GetFloat() );
+			_Extrapolate( pOut, &history[realOlder], &history[info.newer], currentTime - interpolation_amount, cl_extrapolate_amount.GetFloat() );
 		}
 		else
 		{
-			_Interpolate( m_pValue, info.frac, &history[info.older], &history[info.newer] );
+			_Interpolate( pOut, info.frac, &history[info.older], &history[info.newer] );
 		}
 	}
 	else
 	{
-		_Interpolate( m_pValue, info.frac, &history[info.older], &history[info.newer] );
+		_Interpolate( pOut, info.frac, &history[info.older], &history[info.newer] );
+	}
+
+	return true;
+}
+
+template< typename Type, bool IS_ARRAY >
+inline void CInterpolatedVarArrayBase<Type, IS_ARRAY>::PrepareInterpolation( float currentTime, float interpolation_amount )
+{
+#ifndef INTERPOLATEDVAR_PARANOID_MEASUREMENT
+	// Leave debugged vars to Interpolate() so their spew still comes out in order.
+	if ( m_bDebug || !m_pValue )
+		return;
+
+	// This only reads the history, so it's safe as long as nobody latches or interpolates
+	// this var until the batch is done.
+	m_nPreparedNoMoreChanges = 0;
+	m_bPreparedHasValue = InterpolateInto( m_PreparedValue, currentTime, interpolation_amount, &m_nPreparedNoMoreChanges );
+	m_flPreparedTime = currentTime;
+	m_flPreparedAmount = interpolation_amount;
+	m_nPreparedBatch = g_nInterpolationPrepareBatch;
+#endif
+}
+
+template< typename Type, bool IS_ARRAY >
+inline int CInterpolatedVarArrayBase<Type, IS_ARRAY>::Interpolate( float currentTime, float interpolation_amount )
+{
+	int noMoreChanges = 0;
+
+	if ( m_nPreparedBatch == g_nInterpolationPrepareBatch &&
+		m_flPreparedTime == currentTime &&
+		m_flPreparedAmount == interpolation_amount )
+	{
+		// Nothing has touched the history since PrepareInterpolation() ran, so its answer is
+		// the same one we'd compute here.
+		InvalidatePrepared();
+		if ( !m_bPreparedHasValue )
+			return m_nPreparedNoMoreChanges;
+
+		memcpy( m_pValue, m_PreparedValue, sizeof( Type ) * m_nMaxCount );
+		RemoveEntriesPreviousTo( currentTime - interpolation_amount - EXTRA_INTERPOLATION_HISTORY_STORED );
+		return m_nPreparedNoMoreChanges;
+	}
+
+#ifdef INTERPOLATEDVAR_PARANOID_MEASUREMENT
+	Type *backupValues = (Type*)_alloca( m_nMaxCount * sizeof(Type) );
+	memcpy( backupValues, m_pValue, sizeof( Type ) * m_nMaxCount );
+#endif
+
+	if ( !InterpolateInto( m_pValue, currentTime, interpolation_amount, &noMoreChanges ) )
+		return noMoreChanges;
+
+	if ( m_bDebug )
+	{
+		// "value will hold" means we are either extrapolating, or the samples in GetInterpolationInfo are all the same... In either case there are no more "changes" until we latch a new
+		//  value and we can remove this var from the interpolated var list (bit perf optimization)
+		Msg( "%s Interpolate at %f%s\n", GetDebugName(), currentTime, noMoreChanges ? " [value will hold]" : "" );
 	}
 
 #ifdef INTERPOLATEDVAR_PARANOID_MEASUREMENT
@@ -1153,6 +1236,12 @@ inline int CInterpolatedVarArrayBase<Type, IS_ARRAY>::Interpolate( float current
 	return Interpolate( currentTime, m_InterpolationAmount );
 }
 
+template< typename Type, bool IS_ARRAY >
+inline void CInterpolatedVarArrayBase<Type, IS_ARRAY>::PrepareInterpolation( float currentTime )
+{
+	PrepareInterpolation( currentTime, m_InterpolationAmount );
+}
+
 template< typename Type, bool IS_ARRAY >
 inline void CInterpolatedVarArrayBase<Type, IS_ARRAY>::Copy( IInterpolatedVar *pInSrc )
 {
@@ -1182,6 +1271,7 @@ inline void CInterpolatedVarArrayBase<Type, IS_ARRAY>::Copy( IInterpolatedVar *p
 	}
 
 	m_LastNetworkedTime = pSrc->m_LastNetworkedTime;
+	InvalidatePrepared();
 
 	// Copy the entries.
 	m_VarHistory.RemoveAll();
@@ -1266,13 +1356,18 @@ inline void CInterpolatedVarArrayBase<Type, IS_ARRAY>::SetHistoryValuesForItem(
 		CInterpolatedVarEntry *entry = &m_VarHistory[ i ];
 		entry->GetValue()[ item ] = value;
 	}
+	InvalidatePrepared();
 }
 
 template< typename Type, bool IS_ARRAY >
 inline void	CInterpolatedVarArrayBase<Type, IS_ARRAY>::SetLooping( bool looping, int iArrayIndex )
 {
 	Assert( iArrayIndex >= 0 && iArrayIndex < m_nMaxCount );
-	m_bLooping[ iArrayIndex ] = looping;
+	if ( m_bLooping[ iArrayIndex ] != (byte)looping )
+	{
+		m_bLooping[ iArrayIndex ] = looping;
+		InvalidatePrepared();
+	}
 }
 
 template< typename Type, bool IS_ARRAY >
@@ -1289,8 +1384,10 @@ inline void	CInterpolatedVarArrayBase<Type, IS_ARRAY>::SetMaxCount( int newmax )
 	{
 		delete [] m_bLooping;
 		delete [] m_LastNetworkedValue;
+		delete [] m_PreparedValue;
 		m_bLooping = new byte[m_nMaxCount];
 		m_LastNetworkedValue = new Type[m_nMaxCount];
+		m_PreparedValue = new Type[m_nMaxCount];
 		memset( m_bLooping, 0, sizeof(byte) * m_nMaxCount);
 		memset( m_LastNetworkedValue, 0, sizeof(Type) * m_nMaxCount);
 
@@ -68,6 +68,7 @@ static ConVar cl_particle_stats_trigger_count( "cl_particle_stats_trigger_count"
 //-----------------------------------------------------------------------------
 
 #define PARTICLE_SIZE	96
+#define PARTICLE_POOL_BLOCKS_PER_BLOB	256		// Particles per pool allocation; MAX_TOTAL_PARTICLES still caps the total
 
 CParticleMgr *ParticleMgr()
 {
@@ -1034,7 +1035,8 @@ CEffectMaterial* CParticleEffectBinding::GetEffectMaterial( CParticleSubTexture
 //-----------------------------------------------------------------------------
 // CParticleMgr
 //-----------------------------------------------------------------------------
-CParticleMgr::CParticleMgr()
+CParticleMgr::CParticleMgr() :
+	m_ParticlePool( PARTICLE_SIZE, PARTICLE_POOL_BLOCKS_PER_BLOB, CUtlMemoryPool::GROW_FAST, "CParticleMgr::m_ParticlePool", 16 )
 {
 	m_nToolParticleEffectId = 0;
 	m_bUpdatingEffects = false;
@@ -1172,7 +1174,7 @@ Particle *CParticleMgr::AllocParticle( int size )
 	if ( m_nCurrentParticlesAllocated >= MAX_TOTAL_PARTICLES )
 		return NULL;
 		
-	Particle *pRet = (Particle *)malloc( size );
+	Particle *pRet = (Particle *)m_ParticlePool.Alloc( size );
 	if ( pRet )
 		++m_nCurrentParticlesAllocated;
 
@@ -1183,9 +1185,10 @@ void CParticleMgr::FreeParticle( Particle *pParticle )
 {
 	Assert( m_nCurrentParticlesAllocated > 0 );
 	if ( pParticle )
+	{
 		--m_nCurrentParticlesAllocated;
-	
-	free( pParticle );
+		m_ParticlePool.Free( pParticle );
+	}
 }
 
 
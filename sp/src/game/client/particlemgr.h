@@ -126,6 +126,7 @@ entities. Each one is useful under different conditions.
 #endif
 #include "tier1/utlintrusivelist.h"
 #include "tier1/utlstring.h"
+#include "tier1/mempool.h"
 
 
 //-----------------------------------------------------------------------------
@@ -723,6 +724,10 @@ private:
 
 	int m_nCurrentParticlesAllocated;
 
+	// Fixed-size blocks that back every legacy Particle, so adding and removing
+	// particles doesn't go through the heap.
+	CUtlMemoryPool m_ParticlePool;
+
 	// Directional lighting info.
 	CParticleLightInfo m_DirectionalLight;
 
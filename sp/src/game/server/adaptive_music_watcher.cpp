@@ -166,6 +166,7 @@ CAdaptiveMusicChasedWatcher::CAdaptiveMusicChasedWatcher() {
             "npc_zombine"
     };
     lastKnownChased = 0.0f;
+    parallelChasedCount = -1;
 };
 
 void CAdaptiveMusicChasedWatcher::Spawn() {
@@ -173,11 +174,19 @@ void CAdaptiveMusicChasedWatcher::Spawn() {
     Log("FMOD Chased Watcher - Spawning\n");
     SetThink(&CAdaptiveMusicChasedWatcher::WatchChasedThink);
     SetNextThink(gpGlobals->curtime + 0.1f); // Think at 10Hz
+    AddEFlags(EFL_PARALLEL_THINK); // The NPC scan is read-only, it can run on a job thread
+}
+
+void CAdaptiveMusicChasedWatcher::ParallelThink() {
+    parallelChasedCount = CAdaptiveMusicChasedWatcher::GetChasedCount();
 }
 
 void CAdaptiveMusicChasedWatcher::WatchChasedThink() {
+    // Use the count from the parallel think phase if it ran this tick
+    int chasedCount = parallelChasedCount >= 0 ? parallelChasedCount : CAdaptiveMusicChasedWatcher::GetChasedCount();
+    parallelChasedCount = -1;
     if (pAdaptiveMusicPlayer != nullptr) {
-        auto chased = static_cast<float>(CAdaptiveMusicChasedWatcher::GetChasedCount());
+        auto chased = static_cast<float>(chasedCount);
         if (chased != lastKnownChased) {
             lastKnownChased = chased;
             // Send a FMODSetGlobalParameter usermessage
@@ -242,6 +251,7 @@ LINK_ENTITY_TO_CLASS(adaptive_music_entity_watcher, CAdaptiveMusicEntityWatcher
 
 CAdaptiveMusicEntityWatcher::CAdaptiveMusicEntityWatcher() {
     lastKnownEntityStatus = false;
+    parallelEntityStatusState = -1;
 };
 
 void CAdaptiveMusicEntityWatcher::SetEntityWatchedStatus(const char *pStatus) {
@@ -261,11 +271,19 @@ void CAdaptiveMusicEntityWatcher::Spawn() {
     Log("FMOD Entity Watcher - Spawning\n");
     SetThink(&CAdaptiveMusicEntityWatcher::WatchEntityThink);
     SetNextThink(gpGlobals->curtime + 0.1f); // Think at 10Hz
+    AddEFlags(EFL_PARALLEL_THINK); // The entity lookup is read-only, it can run on a job thread
+}
+
+void CAdaptiveMusicEntityWatcher::ParallelThink() {
+    parallelEntityStatusState = CAdaptiveMusicEntityWatcher::GetEntityStatusState(watchedEntityClass, watchedEntityStatus) ? 1 : 0;
 }
 
 void CAdaptiveMusicEntityWatcher::WatchEntityThink() {
+    // Use the state from the parallel think phase if it ran this tick
+    bool statusState = parallelEntityStatusState >= 0 ? parallelEntityStatusState != 0 : CAdaptiveMusicEntityWatcher::GetEntityStatusState(watchedEntityClass, watchedEntityStatus);
+    parallelEntityStatusState = -1;
     if (pAdaptiveMusicPlayer != nullptr) {
-        auto entityStatusState = static_cast<float>(CAdaptiveMusicEntityWatcher::GetEntityStatusState(watchedEntityClass,watchedEntityStatus));
+        auto entityStatusState = static_cast<float>(statusState);
         if (entityStatusState != lastKnownEntityStatus) {
             lastKnownEntityStatus = entityStatusState;
             // Send a FMODSetGlobalParameter usermessage
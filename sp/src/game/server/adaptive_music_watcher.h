@@ -91,6 +91,7 @@ protected:
     // Chased watcher
     std::vector<std::string> enemies;
     float lastKnownChased;
+    int parallelChasedCount; // Computed by ParallelThink, -1 when it didn't run this tick
 
 public:
     DECLARE_CLASS(CAdaptiveMusicChasedWatcher, CAdaptiveMusicWatcher);
@@ -100,6 +101,8 @@ public:
 
     void Spawn() override;
 
+    void ParallelThink() override;
+
     void WatchChasedThink();
 
     bool IsEnemy(const char *className);
@@ -121,6 +124,7 @@ protected:
     const char *watchedEntityStatus;
     const char *watchedEntityScene;
     float lastKnownEntityStatus;
+    int parallelEntityStatusState; // Computed by ParallelThink, -1 when it didn't run this tick
 
 public:
     DECLARE_CLASS(CAdaptiveMusicEntityWatcher, CAdaptiveMusicWatcher);
@@ -136,6 +140,8 @@ public:
 
     void Spawn() override;
 
+    void ParallelThink() override;
+
     void WatchEntityThink();
 
     bool GetEntityStatusState(const char *entityClass, const char *status);
@@ -15,6 +15,7 @@
 #include "ai_link.h"
 #include "ai_network.h"
 #include "ai_networkmanager.h"
+#include "ai_tacticalservices.h"
 #include "saverestore_utlvector.h"
 #include "editor_sendcommand.h"
 #include "bitstring.h"
@@ -474,6 +475,9 @@ void CAI_DynamicLink::SetLinkState(void)
 		return;
 	}
 
+	// Doors and such toggle dynamic links, so any cached cover/LOS traces may be stale
+	AI_InvalidateTacticalTraceCache();
+
 	// ------------------------------------------------------------------
 	// Now update the node links...
 	//  Nodes share links so we only have to find the node from the src 
@@ -19,6 +19,11 @@
 
 
 ASSERT_INVARIANT( ( bits_LINK_STALE_SUGGESTED | bits_LINK_OFF ) <= 255 && ( AI_MOVE_TYPE_BITS <= 255 ) );
+
+// Links are allocated out of large blocks so that walking a node's links
+// during pathfinding stays within a few pages instead of chasing heap nodes.
+DEFINE_FIXEDSIZE_ALLOCATOR( CAI_Link, 1024, CUtlMemoryPool::GROW_FAST );
+
 //-----------------------------------------------------------------------------
 // Purpose:	Given the source node ID, returns the destination ID
 // Input  :
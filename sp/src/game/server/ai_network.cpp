@@ -108,6 +108,7 @@ CAI_Network::CAI_Network()
 {
 	m_iNumNodes				= 0;		// Number of nodes in this network
 	m_pAInode				= NULL;		// Array of all nodes in this network
+	m_bHullPositionsValid	= false;
 
 	m_iNearestCacheNext	= NEARNODE_CACHE_SIZE - 1;
 	// Force empty node caches to be rebuild
@@ -474,9 +475,33 @@ Vector CAI_Network::GetNodePosition( Hull_t hull, int nodeID )
 		return vec3_origin;
 	}
 
+	if ( m_bHullPositionsValid && nodeID < m_iNumNodes )
+		return m_HullPositions[hull][nodeID];
+
 	return m_pAInode[nodeID]->GetPosition( hull );
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: Snapshots every node's hull position into one array per hull so
+//			pathfinding doesn't redo the climb node offset math or touch the
+//			node itself just to read a position. Must be rerun whenever the
+//			nodes are moved, retyped or re-offset.
+//-----------------------------------------------------------------------------
+
+void CAI_Network::BuildHullPositions()
+{
+	for ( int hull = 0; hull < NUM_HULLS; hull++ )
+	{
+		m_HullPositions[hull].SetCount( m_iNumNodes );
+		for ( int node = 0; node < m_iNumNodes; node++ )
+		{
+			m_HullPositions[hull][node] = m_pAInode[node]->GetPosition( hull );
+		}
+	}
+
+	m_bHullPositionsValid = true;
+}
+
 //-----------------------------------------------------------------------------
 
 Vector CAI_Network::GetNodePosition( CBaseCombatCharacter *pNPC, int nodeID )
@@ -533,6 +558,7 @@ CAI_Node *CAI_Network::AddNode( const Vector &origin, float yaw )
 	}
 
 	m_pAInode[m_iNumNodes] = new CAI_Node( m_iNumNodes, origin, yaw );
+	m_bHullPositionsValid = false;
 
 #ifdef AI_NODE_TREE
 	if ( !m_pNodeTree )
@@ -100,6 +100,12 @@ public:
 	Vector			GetNodePosition( Hull_t hull, int nodeID );
 	float			GetNodeYaw( int nodeID );
 
+	// Hull positions of every node, laid out contiguously per hull. NULL until
+	// BuildHullPositions() has run after the last change to the nodes.
+	const Vector *	AccessHullPositions( Hull_t hull ) const	{ return ( m_bHullPositionsValid ) ? m_HullPositions[hull].Base() : NULL; }
+	void			BuildHullPositions();
+	void			InvalidateHullPositions()	{ m_bHullPositionsValid = false; }
+
 	static int		FindBSSmallest(CVarBitVec *bitString, float *float_array, int array_size); 
 
 	int				NearestNodeToPoint( CAI_BaseNPC* pNPC, const Vector &vecOrigin, bool bCheckVisiblity, INearestNodeFilter *pFilter );
@@ -159,6 +165,9 @@ private:
 	int					m_iNumNodes;				// Number of nodes in this network
 	CAI_Node**			m_pAInode;					// Array of all nodes in this network
 
+	CUtlVector<Vector>	m_HullPositions[NUM_HULLS];	// CAI_Node::GetPosition() for each hull, indexed by node id
+	bool				m_bHullPositionsValid;
+
 	enum
 	{
 		PARTITION_NODE	= ( 1 << 0 )
@@ -24,6 +24,7 @@
 #include "ai_hull.h"
 #include "ndebugoverlay.h"
 #include "ai_hint.h"
+#include "ai_tacticalservices.h"
 #include "tier0/icommandline.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
@@ -710,6 +711,8 @@ void CAI_NetworkManager::LoadNetworkGraph( void )
 		DevMsg( "\n** Should run \"Check For Problems\" on the VMF then verify dynamic links\n" );
 #endif
 
+	m_pNetwork->BuildHullPositions();
+
 	gm_fNetworksLoaded = true;
 	CAI_DynamicLink::gm_bInitialized = false;
 }
@@ -893,6 +896,7 @@ void CAI_NetworkManager::DeleteAllAINetworks(void)
 	CAI_DynamicLink::gm_bInitialized = false;
 	gm_fNetworksLoaded = false;
 	g_pBigAINet = NULL;
+	AI_InvalidateTacticalTraceCache();
 }
 
 
@@ -907,7 +911,10 @@ void CAI_NetworkManager::BuildNetworkGraph( void )
 		return;
 
 	CAI_DynamicLink::gm_bInitialized = false;
+	m_pNetwork->InvalidateHullPositions();
 	g_AINetworkBuilder.Build( m_pNetwork );
+	m_pNetwork->BuildHullPositions();
+	AI_InvalidateTacticalTraceCache();
 
 	// If I'm loading for the first time save.  Otherwise I'm 
 	// doing a wc edit and I don't want to save
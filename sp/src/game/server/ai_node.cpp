@@ -28,6 +28,10 @@
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
 
+// Nodes are allocated out of large blocks so the network's nodes sit next to
+// each other in memory rather than scattered across the heap
+DEFINE_FIXEDSIZE_ALLOCATOR( CAI_Node, 256, CUtlMemoryPool::GROW_FAST );
+
 //-----------------------------------------------------------------------------
 
 CAI_Link *CAI_Node::GetLink( int destNodeId )
@@ -307,7 +307,12 @@ AI_Waypoint_t *CAI_Pathfinder::FindBestPath(int startID, int endID)
 
 	nodeG[startID] = 0;
 
-	nodeH[startID] = 0.1*(pAInode[startID]->GetPosition(GetHullType())-pAInode[endID]->GetPosition(GetHullType())).Length(); // Don't want to over estimate
+	// Read positions from the network's per-hull table when it's available
+	// rather than recomputing them from each node visited
+	const Vector *pHullPositions = GetNetwork()->AccessHullPositions( GetHullType() );
+	const Vector vecEndPos = pAInode[endID]->GetPosition(GetHullType());
+
+	nodeH[startID] = 0.1*(pAInode[startID]->GetPosition(GetHullType())-vecEndPos).Length(); // Don't want to over estimate
 	nodeF[startID] = nodeG[startID] + nodeH[startID];
 
 	openBS.Set(startID);
@@ -344,8 +349,8 @@ AI_Waypoint_t *CAI_Pathfinder::FindBestPath(int startID, int endID)
 			int moveType = nodeLink->m_iAcceptedMoveTypes[GetHullType()] & CapabilitiesGet();
 			int testID	 = nodeLink->DestNodeID(smallestID);
 
-			Vector r1 = pSmallestNode->GetPosition(GetHullType());
-			Vector r2 = pAInode[testID]->GetPosition(GetHullType());
+			Vector r1 = ( pHullPositions ) ? pHullPositions[smallestID] : pSmallestNode->GetPosition(GetHullType());
+			Vector r2 = ( pHullPositions ) ? pHullPositions[testID] : pAInode[testID]->GetPosition(GetHullType());
 			float dist   = GetOuter()->GetNavigator()->MovementCost( moveType, r1, r2 ); // MovementCost takes ref parameters!!
 
 			if ( dist == FLT_MAX )
@@ -357,7 +362,7 @@ AI_Waypoint_t *CAI_Pathfinder::FindBestPath(int startID, int endID)
 			{
 				nodeP[testID] = smallestID;
 				nodeG[testID] = new_g;
-				nodeH[testID] = (pAInode[testID]->GetPosition(GetHullType())-pAInode[endID]->GetPosition(GetHullType())).Length();
+				nodeH[testID] = (r2-vecEndPos).Length();
 				nodeF[testID] = nodeG[testID] + nodeH[testID];
 
 				closeBS.Set( testID );
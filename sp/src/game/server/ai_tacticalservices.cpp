@@ -16,12 +16,14 @@
 #include "ai_navigator.h"
 #include "ai_networkmanager.h"
 #include "ai_hint.h"
+#include "collisionutils.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
 
 ConVar ai_find_lateral_cover( "ai_find_lateral_cover", "1" );
 ConVar ai_find_lateral_los( "ai_find_lateral_los", "1" );
+ConVar ai_tactical_trace_cache( "ai_tactical_trace_cache", "1", 0, "Share cover position tests between NPCs searching against the same threat in a tick" );
 
 #ifdef _DEBUG
 ConVar ai_debug_cover( "ai_debug_cover", "0" );
@@ -51,6 +53,134 @@ int g_AIDebugFindLosNode = -1;
 #define ShouldDebugLos( node ) false
 #endif
 
+//-----------------------------------------------------------------------------
+// Per-tick cache of the cover position tests done by the node searches. Squad
+// members searching against the same threat on the same tick test mostly the same
+// nodes, so the trace results are shared. The key holds everything that decides
+// what IsCoverPosition() traces: the quantized threat and test positions, the node
+// and hull, the testing NPC's class, and its enemy.
+// NOTE: The traces ignore the NPC doing the test and pass through its enemy, so when
+// the ray crosses the tester's own body a shared result can report cover that a fresh
+// trace by another NPC would reject, a false positive. In that case the tester goes
+// into the key as well and the result is not shared.
+// Shoot position tests are not cached. WeaponLOSCondition() depends on the NPC's
+// weapon spread, its no-hit capabilities and which squadmates stand in its own
+// spread, and it sets conditions on the NPC as a side effect.
+//-----------------------------------------------------------------------------
+#define TACTICAL_TRACE_QUANTIZE		4.0f
+
+struct TacticalTraceKey_t
+{
+	int			node;
+	int			hull;
+	int			threatPos[3];
+	int			testPos[3];
+	const char *pszClassname;
+	int			iEnemy;
+	int			iTester;
+};
+
+class CAI_TacticalTraceCache
+{
+public:
+	CAI_TacticalTraceCache()
+	 :	m_Results( 0, 0, KeyLessFunc )
+	{
+		m_iTick = -1;
+		m_nHits = 0;
+		m_nMisses = 0;
+	}
+
+	static void InitKey( TacticalTraceKey_t *pKey, int node, CAI_BaseNPC *pNPC, const Vector &vThreatPos, const Vector &vTestPos )
+	{
+		memset( pKey, 0, sizeof(*pKey) );
+		pKey->node = node;
+		pKey->hull = pNPC->GetHullType();
+		for ( int i = 0; i < 3; i++ )
+		{
+			pKey->threatPos[i] = RoundFloatToInt( vThreatPos[i] * ( 1.0f / TACTICAL_TRACE_QUANTIZE ) );
+			pKey->testPos[i] = RoundFloatToInt( vTestPos[i] * ( 1.0f / TACTICAL_TRACE_QUANTIZE ) );
+		}
+		pKey->pszClassname = pNPC->GetClassname();
+		pKey->iEnemy = pNPC->GetEnemy() ? pNPC->GetEnemy()->entindex() : -1;
+
+		Vector vecMins, vecMaxs;
+		pNPC->CollisionProp()->WorldSpaceAABB( &vecMins, &vecMaxs );
+		pKey->iTester = IsBoxIntersectingRay( vecMins, vecMaxs, vThreatPos, vTestPos - vThreatPos, TACTICAL_TRACE_QUANTIZE ) ? pNPC->entindex() : -1;
+	}
+
+	bool Find( const TacticalTraceKey_t &key, bool *pResult )
+	{
+		if ( !ai_tactical_trace_cache.GetBool() )
+			return false;
+
+		if ( m_iTick != gpGlobals->tickcount )
+		{
+			m_Results.RemoveAll();
+			m_iTick = gpGlobals->tickcount;
+		}
+
+		unsigned short i = m_Results.Find( key );
+		if ( i == m_Results.InvalidIndex() )
+		{
+			m_nMisses++;
+			return false;
+		}
+
+		m_nHits++;
+		*pResult = m_Results[i];
+		return true;
+	}
+
+	void Insert( const TacticalTraceKey_t &key, bool bResult )
+	{
+		if ( ai_tactical_trace_cache.GetBool() )
+		{
+			m_Results.InsertOrReplace( key, bResult );
+		}
+	}
+
+	void Invalidate()
+	{
+		m_Results.RemoveAll();
+	}
+
+	void Report()
+	{
+		int nTotal = m_nHits + m_nMisses;
+		Msg( "Tactical trace cache: %d hits, %d misses (%.1f%% hit rate), %d results this tick\n",
+			m_nHits, m_nMisses, nTotal ? ( 100.0f * m_nHits / nTotal ) : 0.0f, m_Results.Count() );
+		m_nHits = 0;
+		m_nMisses = 0;
+	}
+
+private:
+	static bool KeyLessFunc( const TacticalTraceKey_t &lhs, const TacticalTraceKey_t &rhs )
+	{
+		return ( memcmp( &lhs, &rhs, sizeof(TacticalTraceKey_t) ) < 0 );
+	}
+
+	CUtlMap<TacticalTraceKey_t, bool> m_Results;
+	int		m_iTick;
+	int		m_nHits;
+	int		m_nMisses;
+};
+
+static CAI_TacticalTraceCache g_TacticalTraceCache;
+
+void AI_InvalidateTacticalTraceCache()
+{
+	g_TacticalTraceCache.Invalidate();
+}
+
+CON_COMMAND( ai_report_tactical_trace_cache, "Reports the hit rate of the shared cover/LOS trace cache since the last report" )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	g_TacticalTraceCache.Report();
+}
+
 //-----------------------------------------------------------------------------
 
 BEGIN_SIMPLE_DATADESC(CAI_TacticalServices)
@@ -404,7 +534,7 @@ int CAI_TacticalServices::FindCoverNode(const Vector &vNearPos, const Vector &vT
 			if ( GetOuter()->IsValidCover( nodeOrigin, pNode->GetHint() ) )
 			{
 				// Check if this location will block the threat's line of sight to me
-				if (GetOuter()->IsCoverPosition(vThreatEyePos, vEyePos))
+				if ( TestCoverPosition( nodeIndex, vThreatEyePos, vEyePos ) )
 				{
 					// --------------------------------------------------------
 					// Don't let anyone else use this node for a while
@@ -676,6 +806,24 @@ int CAI_TacticalServices::FindLosNode(const Vector &vThreatPos, const Vector &vT
 	return NO_NODE;
 }
 
+//-------------------------------------
+// Cover position test for the node searches, shared through the trace cache
+//-------------------------------------
+
+bool CAI_TacticalServices::TestCoverPosition( int node, const Vector &vThreatEyePos, const Vector &vEyePos )
+{
+	TacticalTraceKey_t key;
+	CAI_TacticalTraceCache::InitKey( &key, node, GetOuter(), vThreatEyePos, vEyePos );
+
+	bool bResult;
+	if ( !g_TacticalTraceCache.Find( key, &bResult ) )
+	{
+		bResult = GetOuter()->IsCoverPosition( vThreatEyePos, vEyePos );
+		g_TacticalTraceCache.Insert( key, bResult );
+	}
+	return bResult;
+}
+
 //-------------------------------------
 // Checks lateral LOS
 //-------------------------------------
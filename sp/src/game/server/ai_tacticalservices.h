@@ -53,6 +53,7 @@ private:
 	// Checks lateral cover
 	bool			TestLateralCover( const Vector &vecCheckStart, const Vector &vecCheckEnd, float flMinDist );
 	bool			TestLateralLos( const Vector &vecCheckStart, const Vector &vecCheckEnd );
+	bool			TestCoverPosition( int node, const Vector &vThreatEyePos, const Vector &vEyePos );
 
 	int				FindBackAwayNode( const Vector &vecThreat );
 	int				FindCoverNode( const Vector &vThreatPos, const Vector &vThreatEyePos, float flMinDist, float flMaxDist );
@@ -77,4 +78,9 @@ private:
 
 //-----------------------------------------------------------------------------
 
+// Drops the shared cover/LOS trace results, call when the world or node graph changes under them
+void AI_InvalidateTacticalTraceCache();
+
+//-----------------------------------------------------------------------------
+
 #endif // AI_TACTICALSERVICES_H
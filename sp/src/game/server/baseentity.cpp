@@ -613,6 +613,13 @@ CBaseEntity *CBaseEntity::GetFollowedEntity()
 void CBaseEntity::SetClassname( const char *className )
 {
 	m_iClassname = AllocPooledString( className );
+	EntityNameIndex_EntityChanged( this );
+}
+
+void CBaseEntity::SetName( string_t newName )
+{
+	m_iName = newName;
+	EntityNameIndex_EntityChanged( this );
 }
 
 void CBaseEntity::SetModelIndex( int index )
@@ -3258,6 +3265,7 @@ void CBaseEntity::OnRestore()
 #endif
 
 	SimThink_EntityChanged( this );
+	EntityNameIndex_EntityChanged( this );
 
 	// touchlinks get recomputed
 	if ( IsEFlagSet( EFL_CHECK_UNTOUCH ) )
@@ -752,6 +752,12 @@ public:
 	void (CBaseEntity::*m_pfnThink)(void);
 	virtual void Think( void ) { if (m_pfnThink) (this->*m_pfnThink)();};
 
+	// Entities with EFL_PARALLEL_THINK get this called from a worker thread on ticks where
+	// they're about to think, before any entity runs its regular think. It may only read
+	// world state and write to this entity's own members; anything with side effects
+	// (outputs, user messages, creating or moving entities) has to be deferred to the think.
+	virtual void ParallelThink( void ) {}
+
 	// Think functions with contexts
 	int		RegisterThinkContext( const char *szContext );
 	BASEPTR	ThinkSet( BASEPTR func, float flNextThinkTime = 0, const char *szContext = NULL );
@@ -1919,11 +1925,6 @@ inline string_t CBaseEntity::GetEntityName()
 	return m_iName; 
 }
 
-inline void CBaseEntity::SetName( string_t newName )
-{
-	m_iName = newName;
-}
-
 
 inline bool CBaseEntity::NameMatches( const char *pszNameOrWildcard )
 {
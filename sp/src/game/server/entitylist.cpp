@@ -11,6 +11,7 @@
 #include "igamesystem.h"
 #include "collisionutils.h"
 #include "UtlSortVector.h"
+#include "bitvec.h"
 #include "tier0/vprof.h"
 #include "mapentities.h"
 #include "client.h"
@@ -127,6 +128,25 @@ void AimTarget_ForceRepopulateList()
 // NOTE: This is usually a small subset of the global entity list, so it's
 // an optimization to maintain this list incrementally rather than polling each
 // frame.
+// NOTE: Entities that only think are also bucketed into a two level timing wheel
+// keyed on their next think tick, so each tick only visits the entities that are due.
+// Due entries are flagged by list position, which keeps ListCopy() in list order.
+// The wheel is never saved; it's rebuilt from the entity think ticks whenever the
+// tick count goes backwards (restore, transition) or jumps past the wheel span.
+#define SIMTHINK_WHEEL0_BITS		8
+#define SIMTHINK_WHEEL0_SIZE		(1 << SIMTHINK_WHEEL0_BITS)
+#define SIMTHINK_WHEEL0_MASK		(SIMTHINK_WHEEL0_SIZE - 1)
+#define SIMTHINK_WHEEL1_BITS		6
+#define SIMTHINK_WHEEL1_SIZE		(1 << SIMTHINK_WHEEL1_BITS)
+#define SIMTHINK_WHEEL1_MASK		(SIMTHINK_WHEEL1_SIZE - 1)
+#define SIMTHINK_WHEEL_SPAN			(SIMTHINK_WHEEL0_SIZE * SIMTHINK_WHEEL1_SIZE)
+
+// bucket layout is level 0 slots, then level 1 slots, then a single overflow bucket
+#define SIMTHINK_BUCKET_WHEEL1		SIMTHINK_WHEEL0_SIZE
+#define SIMTHINK_BUCKET_OVERFLOW	(SIMTHINK_BUCKET_WHEEL1 + SIMTHINK_WHEEL1_SIZE)
+#define SIMTHINK_BUCKET_COUNT		(SIMTHINK_BUCKET_OVERFLOW + 1)
+#define SIMTHINK_INVALID			0xFFFF
+
 struct simthinkentry_t
 {
 	unsigned short	entEntry;
@@ -145,12 +165,20 @@ public:
 		m_simThinkList.Purge();
 		for ( int i = 0; i < ARRAYSIZE(m_entinfoIndex); i++ )
 		{
-			m_entinfoIndex[i] = 0xFFFF;
+			m_entinfoIndex[i] = SIMTHINK_INVALID;
+			m_wheelBucket[i] = SIMTHINK_INVALID;
+		}
+		for ( int i = 0; i < ARRAYSIZE(m_wheelHead); i++ )
+		{
+			m_wheelHead[i] = SIMTHINK_INVALID;
 		}
+		m_dueList.ClearAll();
+		m_wheelTick = 0;
 	}
 	void LevelInitPreEntity()
 	{
 		gEntList.AddListenerEntity( this );
+		m_wheelTick = gpGlobals->tickcount;
 	}
 
 	void LevelShutdownPostEntity()
@@ -161,7 +189,7 @@ public:
 
 	void OnEntityCreated( CBaseEntity *pEntity )
 	{
-		Assert( m_entinfoIndex[pEntity->GetRefEHandle().GetEntryIndex()] == 0xFFFF );
+		Assert( m_entinfoIndex[pEntity->GetRefEHandle().GetEntryIndex()] == SIMTHINK_INVALID );
 	}
 	void OnEntityDeleted( CBaseEntity *pEntity )
 	{
@@ -172,11 +200,18 @@ public:
 	{
 		int listHandle = m_entinfoIndex[index];
 		// If this guy is in the active list, remove him
-		if ( listHandle != 0xFFFF )
+		if ( listHandle != SIMTHINK_INVALID )
 		{
 			Assert(m_simThinkList[listHandle].entEntry == index);
+			WheelUnlink( index );
+
+			// fast remove moves the last entry into this slot, so move its due flag too
+			int last = m_simThinkList.Count() - 1;
+			m_dueList.Set( listHandle, m_dueList.IsBitSet( last ) );
+			m_dueList.Clear( last );
+
 			m_simThinkList.FastRemove( listHandle );
-			m_entinfoIndex[index] = 0xFFFF;
+			m_entinfoIndex[index] = SIMTHINK_INVALID;
 			
 			// fast remove shifted someone, update that someone
 			if ( listHandle < m_simThinkList.Count() )
@@ -192,21 +227,21 @@ public:
 
 	int ListCopy( CBaseEntity *pList[], int listMax )
 	{
+		AdvanceWheel( gpGlobals->tickcount );
+
 		int count = MIN(listMax, ListCount());
 		int out = 0;
-		for ( int i = 0; i < count; i++ )
+		// only copy out entities that will simulate or think this frame
+		for ( int i = m_dueList.FindNextSetBit( 0 ); i >= 0 && i < count; i = m_dueList.FindNextSetBit( i + 1 ) )
 		{
-			// only copy out entities that will simulate or think this frame
-			if ( m_simThinkList[i].nextThinkTick <= gpGlobals->tickcount )
-			{
-				Assert(m_simThinkList[i].nextThinkTick>=0);
-				int entinfoIndex = m_simThinkList[i].entEntry;
-				const CEntInfo *pInfo = gEntList.GetEntInfoPtrByIndex( entinfoIndex );
-				pList[out] = (CBaseEntity *)pInfo->m_pEntity;
-				Assert(m_simThinkList[i].nextThinkTick==0 || pList[out]->GetFirstThinkTick()==m_simThinkList[i].nextThinkTick);
-				Assert( gEntList.IsEntityPtr( pList[out] ) );
-				out++;
-			}
+			Assert(m_simThinkList[i].nextThinkTick>=0);
+			Assert(m_simThinkList[i].nextThinkTick <= gpGlobals->tickcount);
+			int entinfoIndex = m_simThinkList[i].entEntry;
+			const CEntInfo *pInfo = gEntList.GetEntInfoPtrByIndex( entinfoIndex );
+			pList[out] = (CBaseEntity *)pInfo->m_pEntity;
+			Assert(m_simThinkList[i].nextThinkTick==0 || pList[out]->GetFirstThinkTick()==m_simThinkList[i].nextThinkTick);
+			Assert( gEntList.IsEntityPtr( pList[out] ) );
+			out++;
 		}
 
 		return out;
@@ -230,7 +265,7 @@ public:
 		else
 		{
 			// already in the list? (had think or sim last time, now has both - or had both last time, now just one)
-			if ( m_entinfoIndex[index] == 0xFFFF )
+			if ( m_entinfoIndex[index] == SIMTHINK_INVALID )
 			{
 				MEM_ALLOC_CREDIT();
 				m_entinfoIndex[index] = m_simThinkList.AddToTail();
@@ -255,12 +290,135 @@ public:
 					m_simThinkList[m_entinfoIndex[index]].nextThinkTick = 0;
 				}
 			}
+			Schedule( index );
 		}
 	}
 
 private:
+	// Flags the entry as due, or files it in the wheel bucket for its next think tick
+	void Schedule( int index )
+	{
+		int listHandle = m_entinfoIndex[index];
+		Assert( listHandle != SIMTHINK_INVALID );
+
+		WheelUnlink( index );
+		int tick = m_simThinkList[listHandle].nextThinkTick;
+		int delta = tick - m_wheelTick;
+		if ( delta <= 0 )
+		{
+			// simulating entities have a think tick of zero, so they're always due
+			m_dueList.Set( listHandle );
+			return;
+		}
+
+		m_dueList.Clear( listHandle );
+		if ( delta < SIMTHINK_WHEEL0_SIZE )
+		{
+			WheelLink( index, tick & SIMTHINK_WHEEL0_MASK );
+		}
+		else if ( delta < SIMTHINK_WHEEL_SPAN )
+		{
+			WheelLink( index, SIMTHINK_BUCKET_WHEEL1 + ( ( tick >> SIMTHINK_WHEEL0_BITS ) & SIMTHINK_WHEEL1_MASK ) );
+		}
+		else
+		{
+			WheelLink( index, SIMTHINK_BUCKET_OVERFLOW );
+		}
+	}
+
+	void WheelLink( int index, int bucket )
+	{
+		unsigned short head = m_wheelHead[bucket];
+		m_wheelPrev[index] = SIMTHINK_INVALID;
+		m_wheelNext[index] = head;
+		if ( head != SIMTHINK_INVALID )
+		{
+			m_wheelPrev[head] = (unsigned short)index;
+		}
+		m_wheelHead[bucket] = (unsigned short)index;
+		m_wheelBucket[index] = (unsigned short)bucket;
+	}
+
+	void WheelUnlink( int index )
+	{
+		int bucket = m_wheelBucket[index];
+		if ( bucket == SIMTHINK_INVALID )
+			return;
+
+		unsigned short next = m_wheelNext[index];
+		unsigned short prev = m_wheelPrev[index];
+		if ( prev != SIMTHINK_INVALID )
+		{
+			m_wheelNext[prev] = next;
+		}
+		else
+		{
+			m_wheelHead[bucket] = next;
+		}
+		if ( next != SIMTHINK_INVALID )
+		{
+			m_wheelPrev[next] = prev;
+		}
+		m_wheelBucket[index] = SIMTHINK_INVALID;
+	}
+
+	// Detaches a whole bucket and reschedules everything that was in it
+	void RescheduleBucket( int bucket )
+	{
+		unsigned short index = m_wheelHead[bucket];
+		m_wheelHead[bucket] = SIMTHINK_INVALID;
+		while ( index != SIMTHINK_INVALID )
+		{
+			unsigned short next = m_wheelNext[index];
+			m_wheelBucket[index] = SIMTHINK_INVALID;
+			Schedule( index );
+			index = next;
+		}
+	}
+
+	void AdvanceWheel( int tick )
+	{
+		if ( tick < m_wheelTick || tick - m_wheelTick >= SIMTHINK_WHEEL_SPAN )
+		{
+			// time went backwards or skipped further than we can cascade, start over
+			m_wheelTick = tick;
+			for ( int i = 0; i < m_simThinkList.Count(); i++ )
+			{
+				Schedule( m_simThinkList[i].entEntry );
+			}
+			return;
+		}
+
+		while ( m_wheelTick < tick )
+		{
+			m_wheelTick++;
+			int slot = m_wheelTick & SIMTHINK_WHEEL0_MASK;
+			if ( slot == 0 )
+			{
+				// level 0 wrapped, cascade the next level 1 slot (and the overflow when that wraps too)
+				int slot1 = ( m_wheelTick >> SIMTHINK_WHEEL0_BITS ) & SIMTHINK_WHEEL1_MASK;
+				if ( slot1 == 0 )
+				{
+					RescheduleBucket( SIMTHINK_BUCKET_OVERFLOW );
+				}
+				RescheduleBucket( SIMTHINK_BUCKET_WHEEL1 + slot1 );
+			}
+			RescheduleBucket( slot );
+		}
+	}
+
 	unsigned short m_entinfoIndex[NUM_ENT_ENTRIES];
 	CUtlVector<simthinkentry_t>	m_simThinkList;
+
+	// timing wheel buckets are intrusive lists threaded through the entinfo index
+	unsigned short m_wheelHead[SIMTHINK_BUCKET_COUNT];
+	unsigned short m_wheelNext[NUM_ENT_ENTRIES];
+	unsigned short m_wheelPrev[NUM_ENT_ENTRIES];
+	unsigned short m_wheelBucket[NUM_ENT_ENTRIES];
+
+	// indexed by m_simThinkList position, set if the entry thinks or simulates this tick
+	CBitVec<NUM_ENT_ENTRIES> m_dueList;
+	int m_wheelTick;
 };
 
 CSimThinkManager g_SimThinkManager;
@@ -280,6 +438,285 @@ void SimThink_EntityChanged( CBaseEntity *pEntity )
 	g_SimThinkManager.EntityChanged( pEntity );
 }
 
+//-----------------------------------------------------------------------------
+// Classname and targetname indexes for the Find* functions
+// NOTE: Entities are bucketed by their case-folded name, and each bucket is kept
+// sorted by the order the entity was added to the active list, so walking a bucket
+// gives the same order as walking the CEntInfo list. The buckets hang off a trie
+// so trailing-* wildcard searches (npc_*) only visit the buckets under the prefix.
+//-----------------------------------------------------------------------------
+struct entnameentry_t
+{
+	unsigned int	serial;
+	int				entEntry;
+};
+
+struct entnamenode_t
+{
+	int				firstChild;
+	int				nextSibling;
+	int				bucket;
+	char			ch;
+};
+
+class CEntityNameIndex
+{
+public:
+	CEntityNameIndex()
+	{
+		Clear();
+	}
+	void Clear()
+	{
+		m_nodes.Purge();
+		m_buckets.Purge();
+		AddNode( 0 );
+		for ( int i = 0; i < ARRAYSIZE(m_entBucket); i++ )
+		{
+			m_entBucket[i] = -1;
+		}
+	}
+
+	void Update( int entEntry, unsigned int serial, string_t name )
+	{
+		int bucket = ( name != NULL_STRING ) ? FindOrCreateBucket( STRING(name) ) : -1;
+		if ( bucket == m_entBucket[entEntry] )
+			return;
+
+		Remove( entEntry, serial );
+		if ( bucket >= 0 )
+		{
+			CUtlVector<entnameentry_t> &list = m_buckets[bucket];
+			int i = list.InsertBefore( LowerBound( list, serial ) );
+			list[i].serial = serial;
+			list[i].entEntry = entEntry;
+		}
+		m_entBucket[entEntry] = bucket;
+	}
+
+	void Remove( int entEntry, unsigned int serial )
+	{
+		int bucket = m_entBucket[entEntry];
+		if ( bucket < 0 )
+			return;
+
+		CUtlVector<entnameentry_t> &list = m_buckets[bucket];
+		int i = LowerBound( list, serial );
+		Assert( i < list.Count() && list[i].entEntry == entEntry );
+		if ( i < list.Count() && list[i].entEntry == entEntry )
+		{
+			list.Remove( i );
+		}
+		m_entBucket[entEntry] = -1;
+	}
+
+	// Returns the entinfo index of the first entity after startSerial whose name
+	// matches the first nameLen chars of pszName (or starts with them, for prefix searches)
+	int FindNext( const char *pszName, int nameLen, bool bPrefix, unsigned int startSerial ) const
+	{
+		int node = 0;
+		for ( int i = 0; i < nameLen && node >= 0; i++ )
+		{
+			node = FindChild( node, FoldChar( pszName[i] ) );
+		}
+		if ( node < 0 )
+			return -1;
+
+		if ( !bPrefix )
+			return FirstInBucket( m_nodes[node].bucket, startSerial + 1 ).entEntry;
+
+		// walk the subtree under the prefix and pick the earliest entity out of all the buckets
+		entnameentry_t best = { 0, -1 };
+		CUtlVectorFixedGrowable<int, 64> stack;
+		stack.AddToTail( node );
+		while ( stack.Count() )
+		{
+			int cur = stack.Tail();
+			stack.RemoveMultipleFromTail( 1 );
+
+			entnameentry_t entry = FirstInBucket( m_nodes[cur].bucket, startSerial + 1 );
+			if ( entry.entEntry >= 0 && ( best.entEntry < 0 || entry.serial < best.serial ) )
+			{
+				best = entry;
+			}
+
+			for ( int child = m_nodes[cur].firstChild; child >= 0; child = m_nodes[child].nextSibling )
+			{
+				stack.AddToTail( child );
+			}
+		}
+		return best.entEntry;
+	}
+
+private:
+	// simple ascii case conversion, to match NamesMatch()
+	static char FoldChar( char c )
+	{
+		return ( c >= 'A' && c <= 'Z' ) ? ( c - 'A' + 'a' ) : c;
+	}
+
+	static int LowerBound( const CUtlVector<entnameentry_t> &list, unsigned int serial )
+	{
+		int lo = 0;
+		int hi = list.Count();
+		while ( lo < hi )
+		{
+			int mid = ( lo + hi ) >> 1;
+			if ( list[mid].serial < serial )
+			{
+				lo = mid + 1;
+			}
+			else
+			{
+				hi = mid;
+			}
+		}
+		return lo;
+	}
+
+	entnameentry_t FirstInBucket( int bucket, unsigned int minSerial ) const
+	{
+		entnameentry_t none = { 0, -1 };
+		if ( bucket < 0 )
+			return none;
+
+		const CUtlVector<entnameentry_t> &list = m_buckets[bucket];
+		int i = LowerBound( list, minSerial );
+		return ( i < list.Count() ) ? list[i] : none;
+	}
+
+	int AddNode( char ch )
+	{
+		int node = m_nodes.AddToTail();
+		m_nodes[node].firstChild = -1;
+		m_nodes[node].nextSibling = -1;
+		m_nodes[node].bucket = -1;
+		m_nodes[node].ch = ch;
+		return node;
+	}
+
+	int FindChild( int node, char ch ) const
+	{
+		for ( int child = m_nodes[node].firstChild; child >= 0; child = m_nodes[child].nextSibling )
+		{
+			if ( m_nodes[child].ch == ch )
+				return child;
+		}
+		return -1;
+	}
+
+	int FindOrCreateBucket( const char *pszName )
+	{
+		int node = 0;
+		for ( ; *pszName; pszName++ )
+		{
+			char ch = FoldChar( *pszName );
+			int child = FindChild( node, ch );
+			if ( child < 0 )
+			{
+				child = AddNode( ch );
+				m_nodes[child].nextSibling = m_nodes[node].firstChild;
+				m_nodes[node].firstChild = child;
+			}
+			node = child;
+		}
+
+		if ( m_nodes[node].bucket < 0 )
+		{
+			m_nodes[node].bucket = m_buckets.AddToTail();
+		}
+		return m_nodes[node].bucket;
+	}
+
+	CUtlVector<entnamenode_t>					m_nodes;
+	CUtlVector< CUtlVector<entnameentry_t> >	m_buckets;
+	int											m_entBucket[NUM_ENT_ENTRIES];
+};
+
+class CEntityNameIndexManager
+{
+public:
+	CEntityNameIndexManager()
+	{
+		m_nextSerial = 0;
+		memset( m_serial, 0, sizeof(m_serial) );
+	}
+
+	void LevelShutdownPostEntity()
+	{
+		m_classnames.Clear();
+		m_targetnames.Clear();
+	}
+
+	// Called as the entity is linked into the active list, so serials follow list order
+	void AddEntity( CBaseEntity *pEntity, int entEntry )
+	{
+		m_serial[entEntry] = ++m_nextSerial;
+		Update( pEntity, entEntry );
+	}
+
+	void RemoveEntity( int entEntry )
+	{
+		m_classnames.Remove( entEntry, m_serial[entEntry] );
+		m_targetnames.Remove( entEntry, m_serial[entEntry] );
+		m_serial[entEntry] = 0;
+	}
+
+	void EntityChanged( CBaseEntity *pEntity )
+	{
+		const CBaseHandle &eh = pEntity->GetRefEHandle();
+		if ( !eh.IsValid() || gEntList.LookupEntity( eh ) != pEntity )
+			return;
+
+		Update( pEntity, eh.GetEntryIndex() );
+	}
+
+	unsigned int SerialOf( CBaseEntity *pEntity )
+	{
+		return pEntity ? m_serial[pEntity->GetRefEHandle().GetEntryIndex()] : 0;
+	}
+
+	// Only plain names and names with a single trailing * can use the index,
+	// anything else (including "*" on its own, which matches unnamed entities) walks the list
+	static bool ParseQuery( const char *pszName, int *pNameLen, bool *pPrefix )
+	{
+		if ( !pszName || !pszName[0] )
+			return false;
+
+		int len = Q_strlen( pszName );
+		*pPrefix = ( pszName[len-1] == '*' );
+		if ( *pPrefix )
+		{
+			len--;
+		}
+		if ( len == 0 || memchr( pszName, '*', len ) )
+			return false;
+
+		*pNameLen = len;
+		return true;
+	}
+
+	CEntityNameIndex	m_classnames;
+	CEntityNameIndex	m_targetnames;
+
+private:
+	void Update( CBaseEntity *pEntity, int entEntry )
+	{
+		m_classnames.Update( entEntry, m_serial[entEntry], pEntity->m_iClassname );
+		m_targetnames.Update( entEntry, m_serial[entEntry], pEntity->GetEntityName() );
+	}
+
+	unsigned int	m_nextSerial;
+	unsigned int	m_serial[NUM_ENT_ENTRIES];
+};
+
+static CEntityNameIndexManager g_EntityNameIndex;
+
+void EntityNameIndex_EntityChanged( CBaseEntity *pEntity )
+{
+	g_EntityNameIndex.EntityChanged( pEntity );
+}
+
 static CBaseEntityClassList *s_pClassLists = NULL;
 CBaseEntityClassList::CBaseEntityClassList()
 {
@@ -481,6 +918,16 @@ bool CGlobalEntityList::IsEntityPtr( void *pTest )
 //-----------------------------------------------------------------------------
 CBaseEntity *CGlobalEntityList::FindEntityByClassname( CBaseEntity *pStartEntity, const char *szName )
 {
+	int nameLen;
+	bool bPrefix;
+	if ( CEntityNameIndexManager::ParseQuery( szName, &nameLen, &bPrefix ) )
+	{
+		int entEntry = g_EntityNameIndex.m_classnames.FindNext( szName, nameLen, bPrefix, g_EntityNameIndex.SerialOf( pStartEntity ) );
+		CBaseEntity *pEntity = ( entEntry >= 0 ) ? (CBaseEntity *)GetEntInfoPtrByIndex( entEntry )->m_pEntity : NULL;
+		Assert( !pEntity || pEntity->ClassMatches( szName ) );
+		return pEntity;
+	}
+
 	const CEntInfo *pInfo = pStartEntity ? GetEntInfoPtr( pStartEntity->GetRefEHandle() )->m_pNext : FirstEntInfo();
 
 	for ( ;pInfo; pInfo = pInfo->m_pNext )
@@ -590,6 +1037,24 @@ CBaseEntity *CGlobalEntityList::FindEntityByName( CBaseEntity *pStartEntity, con
 
 		return NULL;
 	}
+
+	int nameLen;
+	bool bPrefix;
+	if ( CEntityNameIndexManager::ParseQuery( szName, &nameLen, &bPrefix ) )
+	{
+		CBaseEntity *ent = pStartEntity;
+		for ( ;; )
+		{
+			int entEntry = g_EntityNameIndex.m_targetnames.FindNext( szName, nameLen, bPrefix, g_EntityNameIndex.SerialOf( ent ) );
+			if ( entEntry < 0 )
+				return NULL;
+
+			ent = (CBaseEntity *)GetEntInfoPtrByIndex( entEntry )->m_pEntity;
+			Assert( ent && ent->NameMatches( szName ) );
+			if ( !pFilter || pFilter->ShouldFindEntity( ent ) )
+				return ent;
+		}
+	}
 	
 	const CEntInfo *pInfo = pStartEntity ? GetEntInfoPtr( pStartEntity->GetRefEHandle() )->m_pNext : FirstEntInfo();
 
@@ -1095,6 +1560,8 @@ void CGlobalEntityList::OnAddEntity( IHandleEntity *pEnt, CBaseHandle handle )
 	
 	// NOTE: Must be a CBaseEntity on server
 	Assert( pBaseEnt );
+	g_EntityNameIndex.AddEntity( pBaseEnt, handle.GetEntryIndex() );
+
 	//DevMsg(2,"Created %s\n", pBaseEnt->GetClassname() );
 	for ( i = m_entityListeners.Count()-1; i >= 0; i-- )
 	{
@@ -1125,6 +1592,8 @@ void CGlobalEntityList::OnRemoveEntity( IHandleEntity *pEnt, CBaseHandle handle
 	if ( pBaseEnt->edict() )
 		m_iNumEdicts--;
 
+	g_EntityNameIndex.RemoveEntity( handle.GetEntryIndex() );
+
 	m_iNumEnts--;
 }
 
@@ -1145,6 +1614,9 @@ void CGlobalEntityList::NotifySpawn( CBaseEntity *pEnt )
 	if ( !pEnt )
 		return;
 
+	// keyvalues may have written the classname directly through the datadesc
+	g_EntityNameIndex.EntityChanged( pEnt );
+
 	//DevMsg(2,"Deleted %s\n", pBaseEnt->GetClassname() );
 	for ( int i = m_entityListeners.Count()-1; i >= 0; i-- )
 	{
@@ -1414,6 +1886,7 @@ public:
 		g_TouchManager.LevelShutdownPostEntity();
 		g_AimManager.LevelShutdownPostEntity();
 		g_SimThinkManager.LevelShutdownPostEntity();
+		g_EntityNameIndex.LevelShutdownPostEntity();
 #ifdef HL2_DLL
 		OverrideMoveCache_LevelShutdownPostEntity();
 #endif // HL2_DLL
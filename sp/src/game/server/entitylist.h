@@ -361,4 +361,7 @@ void SimThink_EntityChanged( CBaseEntity *pEntity );
 int SimThink_ListCount();
 int SimThink_ListCopy( CBaseEntity *pList[], int listMax );
 
+// Call this when an entity's classname or targetname changes so the Find* indexes stay in sync
+void EntityNameIndex_EntityChanged( CBaseEntity *pEntity );
+
 #endif // ENTITYLIST_H
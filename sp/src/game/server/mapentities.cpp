@@ -18,6 +18,8 @@
 #include "datacache/imdlcache.h"
 #include "world.h"
 #include "toolframework/iserverenginetools.h"
+#include "vstdlib/jobthread.h"
+#include "tier0/fasttimer.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -32,6 +34,198 @@ struct HierarchicalSpawnMapData_t
 static CStringRegistry *g_pClassnameSpawnPriority = NULL;
 extern edict_t *g_pForceAttachEdict;
 
+ConVar sv_parallel_entity_parse( "sv_parallel_entity_parse", "1", 0, "Tokenize the map's entity lump on the job threads before creating the entities" );
+ConVar sv_parallel_entity_parse_min( "sv_parallel_entity_parse_min", "64", 0, "Fewest entities in the lump before its tokenizing is handed to the job threads" );
+
+//-----------------------------------------------------------------------------
+// One entity block of the lump, tokenized by MapEntity_PreparseEntities
+//-----------------------------------------------------------------------------
+struct PreparsedMapEntity_t
+{
+	const char		*m_pEntData;		// just past the opening brace
+	const char		*m_pEntDataEnd;		// parser position once the keys are walked (normally the closing brace)
+	const char		*m_pNextEntity;		// MapEntity_SkipToNextEntity() from there, NULL at eof
+	bool			m_bHasClassname;
+
+	CUtlVector<char>		m_Strings;		// classname, then key, value, key, value...
+	CUtlVector<int>			m_KeyOffsets;
+	CUtlVector<const char*>	m_KeyValues;	// m_KeyOffsets resolved once m_Strings stops growing
+
+	const char *GetClassname() const { return m_Strings.Base(); }
+};
+
+static void AddPreparsedString( PreparsedMapEntity_t &ent, const char *pString )
+{
+	ent.m_KeyOffsets.AddToTail( ent.m_Strings.Count() );
+	ent.m_Strings.AddMultipleToTail( Q_strlen( pString ) + 1, pString );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Job thread half of MapEntity_PreparseEntities. Walks the keys with the
+//			same CEntityMapData code MapEntity_ParseEntity uses so the results match.
+//-----------------------------------------------------------------------------
+static void PreparseMapEntity( PreparsedMapEntity_t &ent )
+{
+	char keyName[MAPKEY_MAXLENGTH];
+	char value[MAPKEY_MAXLENGTH];
+
+	ent.m_Strings.EnsureCapacity( 256 );
+
+	ent.m_bHasClassname = MapEntity_ExtractValue( ent.m_pEntData, "classname", value );
+	if ( !ent.m_bHasClassname )
+	{
+		value[0] = 0;
+	}
+	ent.m_Strings.AddMultipleToTail( Q_strlen( value ) + 1, value );
+
+	CEntityMapData entData( (char*)ent.m_pEntData );
+	if ( entData.GetFirstKey( keyName, value ) )
+	{
+		do
+		{
+			AddPreparsedString( ent, keyName );
+			AddPreparsedString( ent, value );
+		}
+		while ( entData.GetNextKey( keyName, value ) );
+	}
+
+	ent.m_pEntDataEnd = entData.CurrentBufferPosition();
+	ent.m_pNextEntity = MapEntity_SkipToNextEntity( ent.m_pEntDataEnd, keyName );
+
+	ent.m_KeyValues.SetCount( ent.m_KeyOffsets.Count() );
+	for ( int i = 0; i < ent.m_KeyOffsets.Count(); i++ )
+	{
+		ent.m_KeyValues[i] = ent.m_Strings.Base() + ent.m_KeyOffsets[i];
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Creates the entity named by className and hands it its keys, or just
+//			walks past the keys if the filter doesn't want it.
+//-----------------------------------------------------------------------------
+static void MapEntity_CreateEntity( CBaseEntity *&pEntity, CEntityMapData &entData, const char *className, IMapEntityFilter *pFilter )
+{
+	pEntity = NULL;
+	if ( !pFilter || pFilter->ShouldCreateEntity( className ) )
+	{
+		//
+		// Construct via the LINK_ENTITY_TO_CLASS factory.
+		//
+		if ( pFilter )
+			pEntity = pFilter->CreateNextEntity( className );
+		else
+			pEntity = CreateEntityByName(className);
+
+		//
+		// Set up keyvalues.
+		//
+		if (pEntity != NULL)
+		{
+			pEntity->ParseMapData(&entData);
+		}
+		else
+		{
+			Warning("Can't init %s\n", className);
+		}
+	}
+	else
+	{
+		// Just skip past all the keys.
+		char keyName[MAPKEY_MAXLENGTH];
+		char value[MAPKEY_MAXLENGTH];
+		if ( entData.GetFirstKey(keyName, value) )
+		{
+			do 
+			{
+			} 
+			while ( entData.GetNextKey(keyName, value) );
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: MapEntity_ParseEntity for a block MapEntity_PreparseEntities tokenized
+// Output : Returns the current position in the entity data block.
+//-----------------------------------------------------------------------------
+static const char *MapEntity_ParsePreparsedEntity( CBaseEntity *&pEntity, const PreparsedMapEntity_t &ent, IMapEntityFilter *pFilter )
+{
+	if ( !ent.m_bHasClassname )
+	{
+		Error( "classname missing from entity!\n" );
+	}
+
+	CEntityMapData entData( (char*)ent.m_pEntData );
+	entData.SetPreparsedKeys( ent.m_KeyValues.Base(), ent.m_KeyValues.Count() / 2, ent.m_pEntDataEnd );
+	MapEntity_CreateEntity( pEntity, entData, ent.GetClassname(), pFilter );
+	return entData.CurrentBufferPosition();
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Tokenizes all the entity blocks of the lump on the job threads. Blocks
+//			are found by looking for a '{' starting a line, which is how vbsp writes
+//			them, and the result is only used if chaining the blocks together lands
+//			exactly where the serial parser would have gone.
+// Output : The blocks in lump order, or NULL if the lump must be parsed serially.
+//-----------------------------------------------------------------------------
+static PreparsedMapEntity_t *MapEntity_PreparseEntities( const char *pMapData, int &nEntities )
+{
+	VPROF( "MapEntity_PreparseEntities" );
+
+	nEntities = 0;
+
+	// This also builds the tokenizer's brace table before the job threads share it
+	char token[MAPKEY_MAXLENGTH];
+	if ( !MapEntity_ParseToken( pMapData, token ) )
+		return NULL;
+
+	int nBlocks = 0;
+	const char *p;
+	for ( p = strchr( pMapData, '{' ); p; p = strchr( p + 1, '{' ) )
+	{
+		if ( p == pMapData || p[-1] == '\n' )
+		{
+			nBlocks++;
+		}
+	}
+
+	if ( nBlocks < sv_parallel_entity_parse_min.GetInt() )
+		return NULL;
+
+	PreparsedMapEntity_t *pBlocks = new PreparsedMapEntity_t[nBlocks];
+	int i = 0;
+	for ( p = strchr( pMapData, '{' ); p; p = strchr( p + 1, '{' ) )
+	{
+		if ( p == pMapData || p[-1] == '\n' )
+		{
+			pBlocks[i++].m_pEntData = p + 1;
+		}
+	}
+
+	ParallelProcess( "MapEntity_PreparseEntities", pBlocks, nBlocks, &PreparseMapEntity );
+
+	// Walk the chain the way MapEntity_ParseAllEntities does; a '{' inside a
+	// multi-line value or a malformed block breaks it and we fall back.
+	const char *pPos = pMapData;
+	for ( i = 0; i < nBlocks; i++ )
+	{
+		pPos = MapEntity_ParseToken( pPos, token );
+		if ( pPos != pBlocks[i].m_pEntData || token[0] != '{' || token[1] != 0 )
+			break;
+
+		pPos = pBlocks[i].m_pNextEntity;
+	}
+
+	if ( i != nBlocks || MapEntity_ParseToken( pPos, token ) )
+	{
+		DevMsg( 2, "MapEntity_PreparseEntities: entity lump doesn't split cleanly, parsing serially\n" );
+		delete [] pBlocks;
+		return NULL;
+	}
+
+	nEntities = nBlocks;
+	return pBlocks;
+}
+
 // creates an entity by string name, but does not spawn it
 CBaseEntity *CreateEntityByName( const char *className, int iForceEdictIndex )
 {
@@ -311,6 +505,9 @@ void MapEntity_ParseAllEntities(const char *pMapData, IMapEntityFilter *pFilter,
 {
 	VPROF("MapEntity_ParseAllEntities");
 
+	CFastTimer timer;
+	timer.Start();
+
 	HierarchicalSpawnMapData_t *pSpawnMapData = new HierarchicalSpawnMapData_t[NUM_ENT_ENTRIES];
 	HierarchicalSpawn_t *pSpawnList = new HierarchicalSpawn_t[NUM_ENT_ENTRIES];
 
@@ -325,33 +522,73 @@ void MapEntity_ParseAllEntities(const char *pMapData, IMapEntityFilter *pFilter,
 		pMapData = serverenginetools->GetEntityData( pMapData );
 	}
 
+	// Tokenize the lump up front on the job threads if we can; creating the
+	// entities below still happens serially and in lump order.
+	int nPreparsed = 0;
+	int iPreparsed = 0;
+	PreparsedMapEntity_t *pPreparsed = NULL;
+	if ( sv_parallel_entity_parse.GetBool() && pMapData )
+	{
+		pPreparsed = MapEntity_PreparseEntities( pMapData, nPreparsed );
+	}
+	bool bPreparsed = ( pPreparsed != NULL );
+
+	timer.End();
+	float flPreparseTime = timer.GetDuration().GetMillisecondsF();
+	timer.Start();
+
 	//  Loop through all entities in the map data, creating each.
-	for ( ; true; pMapData = MapEntity_SkipToNextEntity(pMapData, szTokenBuffer) )
+	for ( ; true; pMapData = bPreparsed ? pMapData : MapEntity_SkipToNextEntity(pMapData, szTokenBuffer) )
 	{
-		//
-		// Parse the opening brace.
-		//
-		char token[MAPKEY_MAXLENGTH];
-		pMapData = MapEntity_ParseToken( pMapData, token );
+		CBaseEntity *pEntity;
+		const char *pCurMapData;
 
-		//
-		// Check to see if we've finished or not.
-		//
-		if (!pMapData)
-			break;
+		if ( bPreparsed )
+		{
+			if ( iPreparsed == nPreparsed )
+				break;
 
-		if (token[0] != '{')
+			const PreparsedMapEntity_t &ent = pPreparsed[iPreparsed++];
+			pCurMapData = ent.m_pEntData;
+			pMapData = MapEntity_ParsePreparsedEntity( pEntity, ent, pFilter );
+			if ( pMapData != ent.m_pEntDataEnd && MapEntity_SkipToNextEntity( pMapData, szTokenBuffer ) != ent.m_pNextEntity )
+			{
+				// The keys weren't walked (the entity couldn't be created) and skipping
+				// over them from the top goes somewhere else, so carry on in the text.
+				bPreparsed = false;
+			}
+			else
+			{
+				pMapData = ent.m_pEntDataEnd;
+			}
+		}
+		else
 		{
-			Error( "MapEntity_ParseAllEntities: found %s when expecting {", token);
-			continue;
+			//
+			// Parse the opening brace.
+			//
+			char token[MAPKEY_MAXLENGTH];
+			pMapData = MapEntity_ParseToken( pMapData, token );
+
+			//
+			// Check to see if we've finished or not.
+			//
+			if (!pMapData)
+				break;
+
+			if (token[0] != '{')
+			{
+				Error( "MapEntity_ParseAllEntities: found %s when expecting {", token);
+				continue;
+			}
+
+			//
+			// Parse the entity and add it to the spawn list.
+			//
+			pCurMapData = pMapData;
+			pMapData = MapEntity_ParseEntity(pEntity, pMapData, pFilter);
 		}
 
-		//
-		// Parse the entity and add it to the spawn list.
-		//
-		CBaseEntity *pEntity;
-		const char *pCurMapData = pMapData;
-		pMapData = MapEntity_ParseEntity(pEntity, pMapData, pFilter);
 		if (pEntity == NULL)
 			continue;
 
@@ -434,6 +671,12 @@ void MapEntity_ParseAllEntities(const char *pMapData, IMapEntityFilter *pFilter,
 		}
 	}
 
+	delete [] pPreparsed;
+
+	timer.End();
+	float flCreateTime = timer.GetDuration().GetMillisecondsF();
+	timer.Start();
+
 	// Now loop through all our point_template entities and tell them to make templates of everything they're pointing to
 	int iTemplates = pPointTemplates.Count();
 	for ( int i = 0; i < iTemplates; i++ )
@@ -481,8 +724,16 @@ void MapEntity_ParseAllEntities(const char *pMapData, IMapEntityFilter *pFilter,
 		pPointTemplate->FinishBuildingTemplates();
 	}
 
+	timer.End();
+	float flTemplateTime = timer.GetDuration().GetMillisecondsF();
+	timer.Start();
+
 	SpawnHierarchicalList( nEntities, pSpawnList, bActivateEntities );
 
+	timer.End();
+	DevMsg( 2, "MapEntity_ParseAllEntities: tokenize %.2fms%s, create %.2fms, templates %.2fms, spawn %.2fms\n",
+		flPreparseTime, nPreparsed ? "" : " (serial)", flCreateTime, flTemplateTime, timer.GetDuration().GetMillisecondsF() );
+
 	delete [] pSpawnMapData;
 	delete [] pSpawnList;
 }
@@ -555,42 +806,7 @@ const char *MapEntity_ParseEntity(CBaseEntity *&pEntity, const char *pEntData, I
 		Error( "classname missing from entity!\n" );
 	}
 
-	pEntity = NULL;
-	if ( !pFilter || pFilter->ShouldCreateEntity( className ) )
-	{
-		//
-		// Construct via the LINK_ENTITY_TO_CLASS factory.
-		//
-		if ( pFilter )
-			pEntity = pFilter->CreateNextEntity( className );
-		else
-			pEntity = CreateEntityByName(className);
-
-		//
-		// Set up keyvalues.
-		//
-		if (pEntity != NULL)
-		{
-			pEntity->ParseMapData(&entData);
-		}
-		else
-		{
-			Warning("Can't init %s\n", className);
-		}
-	}
-	else
-	{
-		// Just skip past all the keys.
-		char keyName[MAPKEY_MAXLENGTH];
-		char value[MAPKEY_MAXLENGTH];
-		if ( entData.GetFirstKey(keyName, value) )
-		{
-			do 
-			{
-			} 
-			while ( entData.GetNextKey(keyName, value) );
-		}
-	}
+	MapEntity_CreateEntity( pEntity, entData, className, pFilter );
 
 	//
 	// Return the current parser position in the data block
@@ -33,6 +33,8 @@
 #include "vphysicsupdateai.h"
 #include "tier0/vcrmode.h"
 #include "pushentity.h"
+#include "vstdlib/jobthread.h"
+#include "tier0/fasttimer.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -46,6 +48,9 @@ ConVar vprof_scope_entity_thinks( "vprof_scope_entity_thinks", "0" );
 ConVar vprof_scope_entity_gamephys( "vprof_scope_entity_gamephys", "0" );
 
 ConVar	npc_vphysics	( "npc_vphysics","0");
+
+ConVar sv_parallel_think( "sv_parallel_think", "1", 0, "Run ParallelThink() for entities that have one on the job threads before the think pass" );
+ConVar sv_parallel_think_min( "sv_parallel_think_min", "4", 0, "Fewest due parallel thinkers in a tick before they're handed to the job threads" );
 //-----------------------------------------------------------------------------
 // helper method for trace hull as used by physics...
 //-----------------------------------------------------------------------------
@@ -2013,6 +2018,118 @@ void Physics_SimulateEntity( CBaseEntity *pEntity )
 		pEntity->PhysicsRunThink();
 	}
 }
+//-----------------------------------------------------------------------------
+// Parallel think phase
+// Entities flagged EFL_PARALLEL_THINK that don't simulate game physics get their
+// ParallelThink() run on the job threads before the serial pass. The serial pass
+// still runs every think in list order, so whatever a ParallelThink() computed gets
+// committed by its regular think in a deterministic order.
+//-----------------------------------------------------------------------------
+static CInterlockedInt s_nParallelThinkWorkUsec;
+
+struct parallelthinkstats_t
+{
+	int		ticks;
+	int		parallelTicks;
+	int		entities;
+	double	workMsec;	// summed time spent inside ParallelThink()
+	double	wallMsec;	// time the phase actually took on the main thread
+};
+static parallelthinkstats_t s_ParallelThinkStats;
+static CUtlDict<int, unsigned short> s_ParallelThinkClasses;
+
+static void RunParallelThink( CBaseEntity *&pEntity )
+{
+	CFastTimer timer;
+	timer.Start();
+	pEntity->ParallelThink();
+	timer.End();
+	s_nParallelThinkWorkUsec += (int)timer.GetDuration().GetMicroseconds();
+}
+
+static void Physics_RunParallelThinkFunctions( CBaseEntity **pList, int count )
+{
+	VPROF( "Physics_RunParallelThinkFunctions" );
+
+	CBaseEntity **pThinkers = (CBaseEntity **)stackalloc( sizeof(CBaseEntity *) * count );
+	int thinkerCount = 0;
+	for ( int i = 0; i < count; i++ )
+	{
+		CBaseEntity *pEntity = pList[i];
+		if ( !pEntity || !pEntity->IsEFlagSet( EFL_PARALLEL_THINK ) || !pEntity->IsEFlagSet( EFL_NO_GAME_PHYSICS_SIMULATION ) )
+			continue;
+
+		if ( pEntity->IsMarkedForDeletion() )
+			continue;
+
+		int thinkTick = pEntity->GetFirstThinkTick();
+		if ( thinkTick == TICK_NEVER_THINK || thinkTick > gpGlobals->tickcount )
+			continue;
+
+		pThinkers[thinkerCount++] = pEntity;
+	}
+
+	if ( thinkerCount )
+	{
+		CFastTimer timer;
+		timer.Start();
+		s_nParallelThinkWorkUsec = 0;
+
+		bool bParallel = ( thinkerCount >= sv_parallel_think_min.GetInt() );
+		if ( bParallel )
+		{
+			ParallelProcess( "Physics_RunParallelThinkFunctions", pThinkers, thinkerCount, &RunParallelThink );
+		}
+		else
+		{
+			for ( int i = 0; i < thinkerCount; i++ )
+			{
+				RunParallelThink( pThinkers[i] );
+			}
+		}
+		timer.End();
+
+		s_ParallelThinkStats.ticks++;
+		s_ParallelThinkStats.entities += thinkerCount;
+		s_ParallelThinkStats.workMsec += s_nParallelThinkWorkUsec * 0.001;
+		s_ParallelThinkStats.wallMsec += timer.GetDuration().GetMillisecondsF();
+		if ( bParallel )
+		{
+			s_ParallelThinkStats.parallelTicks++;
+		}
+
+		for ( int i = 0; i < thinkerCount; i++ )
+		{
+			const char *pClassname = pThinkers[i]->GetClassname();
+			unsigned short index = s_ParallelThinkClasses.Find( pClassname );
+			if ( index == s_ParallelThinkClasses.InvalidIndex() )
+			{
+				index = s_ParallelThinkClasses.Insert( pClassname, 0 );
+			}
+			s_ParallelThinkClasses[index]++;
+		}
+	}
+
+	stackfree( pThinkers );
+}
+
+CON_COMMAND( report_parallelthink, "Lists the entities that ran ParallelThink() and how much think time it saved, then resets the counters" )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	const parallelthinkstats_t &stats = s_ParallelThinkStats;
+	Msg( "Parallel think: %d ticks (%d on job threads), %d entities\n", stats.ticks, stats.parallelTicks, stats.entities );
+	Msg( "  ParallelThink() time %.3fms, main thread time %.3fms, saved %.3fms\n", stats.workMsec, stats.wallMsec, MAX( stats.workMsec - stats.wallMsec, 0.0 ) );
+	for ( unsigned short i = s_ParallelThinkClasses.First(); i != s_ParallelThinkClasses.InvalidIndex(); i = s_ParallelThinkClasses.Next( i ) )
+	{
+		Msg( "  %5d %s\n", s_ParallelThinkClasses[i], s_ParallelThinkClasses.GetElementName( i ) );
+	}
+
+	memset( &s_ParallelThinkStats, 0, sizeof(s_ParallelThinkStats) );
+	s_ParallelThinkClasses.Purge();
+}
+
 //-----------------------------------------------------------------------------
 // Purpose: Runs the main physics simulation loop against all entities ( except players )
 //-----------------------------------------------------------------------------
@@ -2054,6 +2171,11 @@ void Physics_RunThinkFunctions( bool simulating )
 		// Do we really need UTIL_RemoveImmediate()?
 		int count = SimThink_ListCopy( list, listMax );
 
+		if ( sv_parallel_think.GetBool() )
+		{
+			Physics_RunParallelThinkFunctions( list, count );
+		}
+
 		//DevMsg(1, "Count: %d\n", count );
 		for ( int i = 0; i < count; i++ )
 		{
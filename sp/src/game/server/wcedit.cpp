@@ -343,6 +343,7 @@ void NWCEdit::DestroyAINode( CBasePlayer *pPlayer )
 			// Mark this node as deleted and changed
 			pAINode->SetType( NODE_DELETED );
 			pAINode->m_eNodeInfo   |= bits_NODE_WC_CHANGED;
+			g_pAINetworkManager->GetNetwork()->InvalidateHullPositions();
 
 			// Note that network needs to be rebuild
 			g_pAINetworkManager->GetEditOps()->SetRebuildFlags();
@@ -15,6 +15,7 @@
 #include "tier0/vprof.h"
 #include "checksum_crc.h"
 #include "tier0/icommandline.h"
+#include "tier1/utlbuffer.h"
 
 #if defined( TF_CLIENT_DLL ) || defined( TF_DLL )
 #include "tf_shareddefs.h"
@@ -38,6 +39,9 @@
 #include "tier0/memdbgon.h"
 
 static ConVar sv_soundemitter_trace( "sv_soundemitter_trace", "0", FCVAR_REPLICATED, "Show all EmitSound calls including their symbolic name and the actual wave file they resolved to\n" );
+#if !defined( CLIENT_DLL )
+static ConVar sv_soundemitter_prefetch( "sv_soundemitter_prefetch", "1", 0, "Remember which script sounds each map emits and prefetch their waves the next time it loads\n" );
+#endif
 #ifdef STAGING_ONLY
 static ConVar sv_snd_filter( "sv_snd_filter", "", FCVAR_REPLICATED, "Filters out all sounds not containing the specified string before being emitted\n" );
 #endif // STAGING_ONLY
@@ -57,6 +61,54 @@ void ClearModelSoundsCache();
 
 #endif // !CLIENT_DLL
 
+//-----------------------------------------------------------------------------
+// Script sound names handed to EmitSound are nearly always string literals.
+// Remember which handle a name pointer resolved to so repeat emits skip the
+// sound emitter's dictionary search. An entry is only trusted while the set of
+// scripts is unchanged and the handle still names the same script. The script's
+// name is looked up again rather than kept, since soundemitterbase is shared with
+// the other game DLL and may rebuild its dictionary behind our back.
+//-----------------------------------------------------------------------------
+#define SOUND_HANDLE_CACHE_SIZE	1024
+
+struct SoundHandleCacheEntry_t
+{
+	const char			*pszSoundName;
+	int					nGeneration;
+	HSOUNDSCRIPTHANDLE	handle;
+};
+
+static SoundHandleCacheEntry_t g_SoundHandleCache[SOUND_HANDLE_CACHE_SIZE];
+static int g_nSoundHandleCacheGeneration = 1;
+
+// Call whenever sound scripts are loaded, reloaded or overridden
+static void InvalidateSoundHandleCache()
+{
+	g_nSoundHandleCacheGeneration++;
+}
+
+static HSOUNDSCRIPTHANDLE FindSoundScriptHandle( const char *pszSoundName )
+{
+	uintp key = (uintp)pszSoundName;
+	SoundHandleCacheEntry_t &entry = g_SoundHandleCache[ ( ( key >> 3 ) ^ ( key >> 13 ) ) & ( SOUND_HANDLE_CACHE_SIZE - 1 ) ];
+
+	if ( entry.pszSoundName == pszSoundName && entry.nGeneration == g_nSoundHandleCacheGeneration &&
+		 soundemitterbase->IsValidIndex( entry.handle ) &&
+		 !Q_stricmp( pszSoundName, soundemitterbase->GetSoundName( entry.handle ) ) )
+	{
+		return entry.handle;
+	}
+
+	int soundIndex = soundemitterbase->GetSoundIndex( pszSoundName );
+	if ( !soundemitterbase->IsValidIndex( soundIndex ) )
+		return (HSOUNDSCRIPTHANDLE)soundIndex;
+
+	entry.pszSoundName = pszSoundName;
+	entry.nGeneration = g_nSoundHandleCacheGeneration;
+	entry.handle = (HSOUNDSCRIPTHANDLE)soundIndex;
+	return entry.handle;
+}
+
 void WaveTrace( char const *wavname, char const *funcname )
 {
 	if ( IsX360() && !IsDebug() )
@@ -142,6 +194,7 @@ public:
 	bool			m_bLogPrecache;
 	FileHandle_t	m_hPrecacheLogFile;
 	CUtlSymbolTable m_PrecachedScriptSounds;
+	CUtlVector< unsigned char > m_EmittedSounds;	// indexed by sound script handle
 public:
 	CSoundEmitterSystem( char const *pszName ) :
 		m_bLogPrecache( false ),
@@ -208,6 +261,85 @@ public:
 
 		m_PrecachedScriptSounds.RemoveAll();
 	}
+
+	void MarkEmitted( HSOUNDSCRIPTHANDLE handle )
+	{
+		if ( handle >= 0 && handle < m_EmittedSounds.Count() )
+		{
+			m_EmittedSounds[ handle ] = 1;
+		}
+	}
+
+	void GetEmittedSoundsFileName( char *pszFileName, int nMaxLen )
+	{
+		Q_snprintf( pszFileName, nMaxLen, "soundcache/%s.emitted", STRING( gpGlobals->mapname ) );
+		Q_FixSlashes( pszFileName );
+		Q_strlower( pszFileName );
+	}
+
+	// Start the async load of every script sound the last run of this map emitted. The
+	// waves themselves were precached by whoever uses them; this just gets the data
+	// moving before the first emit needs it.
+	void PrefetchEmittedSounds()
+	{
+		if ( !sv_soundemitter_prefetch.GetBool() )
+			return;
+
+		char szFileName[ MAX_PATH ];
+		GetEmittedSoundsFileName( szFileName, sizeof( szFileName ) );
+
+		CUtlBuffer buf( 0, 0, CUtlBuffer::TEXT_BUFFER );
+		if ( !filesystem->ReadFile( szFileName, "DEFAULT_WRITE_PATH", buf ) )
+			return;
+
+		int nPrefetched = 0;
+		char szSoundName[ 256 ];
+		while ( buf.IsValid() && buf.TellGet() < buf.TellPut() )
+		{
+			buf.GetLine( szSoundName, sizeof( szSoundName ) );
+			Q_StripPrecedingAndTrailingWhitespace( szSoundName );
+			if ( !szSoundName[0] )
+				continue;
+
+			int soundIndex = soundemitterbase->GetSoundIndex( szSoundName );
+			if ( !soundemitterbase->IsValidIndex( soundIndex ) )
+				continue;
+
+			InternalPrefetchWaves( soundIndex );
+			nPrefetched++;
+
+			// Keep it in the list even if this run happens not to play it
+			MarkEmitted( (HSOUNDSCRIPTHANDLE)soundIndex );
+		}
+
+		DevMsg( 2, "CSoundEmitterSystem:  prefetched %d script sounds from %s\n", nPrefetched, szFileName );
+	}
+
+	void WriteEmittedSounds()
+	{
+		if ( !sv_soundemitter_prefetch.GetBool() || !gpGlobals->mapname.ToCStr()[0] )
+			return;
+
+		CUtlBuffer buf( 0, 0, CUtlBuffer::TEXT_BUFFER );
+		for ( int i = 0; i < m_EmittedSounds.Count(); i++ )
+		{
+			if ( m_EmittedSounds[ i ] && soundemitterbase->IsValidIndex( i ) )
+			{
+				buf.PutString( soundemitterbase->GetSoundName( i ) );
+				buf.PutChar( '\n' );
+			}
+		}
+
+		m_EmittedSounds.RemoveAll();
+
+		if ( !buf.TellPut() )
+			return;
+
+		char szFileName[ MAX_PATH ];
+		GetEmittedSoundsFileName( szFileName, sizeof( szFileName ) );
+		filesystem->CreateDirHierarchy( "soundcache", "DEFAULT_WRITE_PATH" );
+		filesystem->WriteFile( szFileName, "DEFAULT_WRITE_PATH", buf );
+	}
 #else
 	CSoundEmitterSystem( char const *name )
 	{
@@ -224,6 +356,7 @@ public:
 #endif
 		g_pClosecaption = cvar->FindVar("closecaption");
 		Assert(g_pClosecaption);
+		InvalidateSoundHandleCache();
 		return soundemitterbase->ModInit();
 	}
 
@@ -234,11 +367,13 @@ public:
 		FinishLog();
 #endif
 		soundemitterbase->ModShutdown();
+		InvalidateSoundHandleCache();
 	}
 
 	void ReloadSoundEntriesInList( IFileList *pFilesToReload )
 	{
 		soundemitterbase->ReloadSoundEntriesInList( pFilesToReload );
+		InvalidateSoundHandleCache();
 	}
 
 	virtual void TraceEmitSound( char const *fmt, ... )
@@ -313,6 +448,8 @@ public:
 		}
 #endif
 
+		InvalidateSoundHandleCache();
+
 #if !defined( CLIENT_DLL )
 		for ( int i=soundemitterbase->First(); i != soundemitterbase->InvalidIndex(); i=soundemitterbase->Next( i ) )
 		{
@@ -322,16 +459,32 @@ public:
 				InternalPrecacheWaves( i );
 			}
 		}
+
+		m_EmittedSounds.RemoveAll();
+		m_EmittedSounds.SetCount( soundemitterbase->GetSoundCount() );
+		V_memset( m_EmittedSounds.Base(), 0, m_EmittedSounds.Count() );
 #endif
 	}
 
 	virtual void LevelInitPostEntity()
 	{
+#if !defined( CLIENT_DLL )
+		PrefetchEmittedSounds();
+#endif
 	}
 
+#if !defined( CLIENT_DLL )
+	virtual void LevelShutdownPreEntity()
+	{
+		// Before the overrides go away, so the handles still name the same sounds
+		WriteEmittedSounds();
+	}
+#endif
+
 	virtual void LevelShutdownPostEntity()
 	{
 		soundemitterbase->ClearSoundOverrides();
+		InvalidateSoundHandleCache();
 
 #if !defined( CLIENT_DLL )
 		FinishLog();
@@ -457,6 +610,10 @@ public:
 			return;
 		}
 
+#if !defined( CLIENT_DLL )
+		MarkEmitted( handle );
+#endif
+
 		if ( !params.soundname[0] )
 			return;
 
@@ -624,7 +781,7 @@ public:
 
 		if ( ep.m_hSoundScriptHandle == SOUNDEMITTER_INVALID_HANDLE )
 		{
-			ep.m_hSoundScriptHandle = (HSOUNDSCRIPTHANDLE)soundemitterbase->GetSoundIndex( ep.m_pSoundName );
+			ep.m_hSoundScriptHandle = FindSoundScriptHandle( ep.m_pSoundName );
 		}
 
 		if ( ep.m_hSoundScriptHandle == -1 )
@@ -865,7 +1022,7 @@ public:
 	{
 		if ( handle == SOUNDEMITTER_INVALID_HANDLE )
 		{
-			handle = (HSOUNDSCRIPTHANDLE)soundemitterbase->GetSoundIndex( soundname );
+			handle = FindSoundScriptHandle( soundname );
 		}
 
 		if ( handle == SOUNDEMITTER_INVALID_HANDLE )
@@ -898,7 +1055,7 @@ public:
 
 	void StopSound( int entindex, const char *soundname )
 	{
-		HSOUNDSCRIPTHANDLE handle = (HSOUNDSCRIPTHANDLE)soundemitterbase->GetSoundIndex( soundname );
+		HSOUNDSCRIPTHANDLE handle = FindSoundScriptHandle( soundname );
 		if ( handle == SOUNDEMITTER_INVALID_HANDLE )
 		{
 			return;
@@ -1337,6 +1494,10 @@ void CBaseEntity::StopSound( int iEntIndex, int iChannel, const char *pSample )
 
 soundlevel_t CBaseEntity::LookupSoundLevel( const char *soundname )
 {
+	HSOUNDSCRIPTHANDLE handle = FindSoundScriptHandle( soundname );
+	if ( handle != SOUNDEMITTER_INVALID_HANDLE )
+		return soundemitterbase->LookupSoundLevelByHandle( soundname, handle );
+
 	return soundemitterbase->LookupSoundLevel( soundname );
 }
 
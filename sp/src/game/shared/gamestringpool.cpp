@@ -16,6 +16,11 @@
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
 
+// Pooled strings are packed into blocks of this size; longer strings get a
+// block of their own
+#define STRING_POOL_BLOCK_SIZE		( 64 * 1024 )
+#define STRING_POOL_MAX_PACKED_LEN	( STRING_POOL_BLOCK_SIZE / 4 )
+
 //-----------------------------------------------------------------------------
 // Purpose: The actual storage for pooled per-level strings
 //-----------------------------------------------------------------------------
@@ -36,14 +41,57 @@ class CGameStringPool : public CBaseGameSystem
 #endif
 		m_Strings.Purge();
 		m_KeyLookupCache.Purge();
+
+		for ( int i = 0; i < m_Blocks.Count(); ++i )
+		{
+			delete [] m_Blocks[i];
+		}
+		m_Blocks.Purge();
+		m_pNextString = NULL;
+		m_nBlockBytesLeft = 0;
+	}
+
+	// Copies a string into the level's blocks. Nothing is freed individually;
+	// FreeAll releases the blocks at level shutdown.
+	const char *CopyString( const char *string )
+	{
+		int nBytes = Q_strlen( string ) + 1;
+
+		char *pCopy;
+		if ( nBytes > STRING_POOL_MAX_PACKED_LEN )
+		{
+			pCopy = new char[ nBytes ];
+			m_Blocks.AddToTail( pCopy );
+		}
+		else
+		{
+			if ( nBytes > m_nBlockBytesLeft )
+			{
+				m_pNextString = new char[ STRING_POOL_BLOCK_SIZE ];
+				m_nBlockBytesLeft = STRING_POOL_BLOCK_SIZE;
+				m_Blocks.AddToTail( m_pNextString );
+			}
+
+			pCopy = m_pNextString;
+			m_pNextString += nBytes;
+			m_nBlockBytesLeft -= nBytes;
+		}
+
+		Q_memcpy( pCopy, string, nBytes );
+		return pCopy;
 	}
 
-	CUtlHashtable<CUtlConstString> m_Strings;
+	// Keys point into m_Blocks
+	CUtlHashtable<const char*> m_Strings;
 	CUtlHashtable<const void*, const char*> m_KeyLookupCache;
 
+	CUtlVector<char*> m_Blocks;
+	char *m_pNextString;
+	int m_nBlockBytesLeft;
+
 public:
 
-	CGameStringPool() : m_Strings(256) { }
+	CGameStringPool() : m_Strings(256), m_pNextString( NULL ), m_nBlockBytesLeft( 0 ) { }
 
 	~CGameStringPool() { FreeAll(); }
 
@@ -52,7 +100,7 @@ public:
 		CUtlVector<const char*> strings( 0, m_Strings.Count() );
 		for (UtlHashHandle_t i = m_Strings.FirstHandle(); i != m_Strings.InvalidHandle(); i = m_Strings.NextHandle(i))
 		{
-			strings.AddToTail( strings[i] );
+			strings.AddToTail( m_Strings.Key(i) );
 		}
 		struct _Local {
 			static int __cdecl F(const char * const *a, const char * const *b) { return strcmp(*a, *b); }
@@ -70,12 +118,19 @@ public:
 	const char *Find(const char *string)
 	{
 		UtlHashHandle_t i = m_Strings.Find( string );
-		return i == m_Strings.InvalidHandle() ? NULL : m_Strings[ i ].Get();
+		return i == m_Strings.InvalidHandle() ? NULL : m_Strings.Key( i );
 	}
 
 	const char *Allocate(const char *string)
 	{
-		return m_Strings[ m_Strings.Insert( string ) ].Get();
+		unsigned int hash = StringHashFunctor()( string );
+		UtlHashHandle_t i = m_Strings.Find( string, hash );
+		if ( i != m_Strings.InvalidHandle() )
+			return m_Strings.Key( i );
+
+		const char *pCopy = CopyString( string );
+		m_Strings.Insert( pCopy, empty_t(), hash );
+		return pCopy;
 	}
 
 	const char *AllocateWithKey(const char *string, const void* key)
@@ -213,9 +213,18 @@ bool CEntityMapData::ExtractValue( const char *keyName, char *value )
 bool CEntityMapData::GetFirstKey( char *keyName, char *value )
 {
 	m_pCurrentKey = m_pEntData; // reset the status pointer
+	m_iPreparsedKey = 0;
 	return GetNextKey( keyName, value );
 }
 
+void CEntityMapData::SetPreparsedKeys( const char * const *ppKeyValues, int nKeys, const char *pEnd )
+{
+	m_ppPreparsedKeys = ppKeyValues;
+	m_nPreparsedKeys = nKeys;
+	m_iPreparsedKey = 0;
+	m_pPreparsedEnd = (char*)pEnd;
+}
+
 const char *CEntityMapData::CurrentBufferPosition( void )
 {
 	return m_pCurrentKey;
@@ -223,6 +232,21 @@ const char *CEntityMapData::CurrentBufferPosition( void )
 
 bool CEntityMapData::GetNextKey( char *keyName, char *value )
 {
+	if ( m_ppPreparsedKeys )
+	{
+		if ( m_iPreparsedKey >= m_nPreparsedKeys )
+		{
+			m_pCurrentKey = m_pPreparsedEnd;
+			return false;
+		}
+
+		// already trimmed and truncated exactly as below
+		Q_strncpy( keyName, m_ppPreparsedKeys[m_iPreparsedKey * 2], MAPKEY_MAXLENGTH );
+		Q_strncpy( value, m_ppPreparsedKeys[m_iPreparsedKey * 2 + 1], MAPKEY_MAXLENGTH );
+		m_iPreparsedKey++;
+		return true;
+	}
+
 	char token[MAPKEY_MAXLENGTH];
 
 	// parse key
@@ -25,9 +25,20 @@ private:
 	int		m_nEntDataSize;
 	char	*m_pCurrentKey;
 
+	// Keys tokenized ahead of time (key, value, key, value...), see SetPreparsedKeys
+	const char * const *m_ppPreparsedKeys;
+	int		m_nPreparsedKeys;
+	int		m_iPreparsedKey;
+	char	*m_pPreparsedEnd;
+
 public:
 	explicit CEntityMapData( char *entBlock, int nEntBlockSize = -1 ) : 
-		m_pEntData(entBlock), m_nEntDataSize(nEntBlockSize), m_pCurrentKey(entBlock) {}
+		m_pEntData(entBlock), m_nEntDataSize(nEntBlockSize), m_pCurrentKey(entBlock),
+		m_ppPreparsedKeys(NULL), m_nPreparsedKeys(0), m_iPreparsedKey(0), m_pPreparsedEnd(NULL) {}
+
+	// Makes GetFirstKey/GetNextKey walk nKeys key/value pairs that were already parsed out of
+	// this block instead of the text. pEnd is where the text walk would have left the parser.
+	void SetPreparsedKeys( const char * const *ppKeyValues, int nKeys, const char *pEnd );
 
 	// find the keyName in the entdata and puts it's value into Value.  returns false if key is not found
 	bool ExtractValue( const char *keyName, char *Value );
@@ -21,6 +21,7 @@
 #include "predictioncopy.h"
 #include "engine/ivmodelinfo.h"
 #include "tier1/fmtstr.h"
+#include "tier1/utlhashtable.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -1373,6 +1374,255 @@ void CPredictionCopy::DetermineWatchField( const char *operation, int entindex,
 	m_pWatchField = FindFieldByName( pwatchvar.GetString(), dmap );
 }
 
+static ConVar cl_pred_copyplans( "cl_pred_copyplans", "1", 0, "Use precompiled copy plans for prediction save/restore when nothing is being compared or watched." );
+
+//-----------------------------------------------------------------------------
+// A copy plan is the result of walking a datamap once for a given copy type and
+//  packed/unpacked layout, flattened into a list of memcpys. Adjacent fields are
+//  merged, so save/restore of a predicted entity comes down to a few copies.
+//-----------------------------------------------------------------------------
+struct predcopyrun_t
+{
+	int		destOffset;
+	int		srcOffset;
+	int		size;		// -1 for null-terminated strings
+	int		order;		// position in the datamap walk, used to keep the sort stable
+};
+
+struct predcopyplan_t
+{
+	// False if the datamap has something that can't be flattened (e.g. embedded pointers)
+	bool						m_bUsable;
+	CUtlVector< predcopyrun_t >	m_Runs;
+};
+
+struct predcopyplankey_t
+{
+	datamap_t	*dmap;
+	int			type;
+	int			destOffsetIndex;
+	int			srcOffsetIndex;
+
+	bool operator==( const predcopyplankey_t &other ) const
+	{
+		return dmap == other.dmap && type == other.type &&
+			destOffsetIndex == other.destOffsetIndex && srcOffsetIndex == other.srcOffsetIndex;
+	}
+};
+
+struct PredCopyPlanKeyHashFunctor
+{
+	unsigned int operator()( const predcopyplankey_t &key ) const
+	{
+		return HashIntConventional( (int)(intp)key.dmap ) ^ ( key.type << 2 ) ^ ( key.destOffsetIndex << 4 ) ^ ( key.srcOffsetIndex << 5 );
+	}
+};
+
+class CPredictionCopyPlans
+{
+public:
+	~CPredictionCopyPlans()
+	{
+		FOR_EACH_HASHTABLE( m_Plans, i )
+		{
+			delete m_Plans.Element( i );
+		}
+		m_Plans.Purge();
+	}
+
+	predcopyplan_t *Find( const predcopyplankey_t &key )
+	{
+		UtlHashHandle_t h = m_Plans.Find( key );
+		return ( h != m_Plans.InvalidHandle() ) ? m_Plans.Element( h ) : NULL;
+	}
+
+	void Insert( const predcopyplankey_t &key, predcopyplan_t *pPlan )
+	{
+		m_Plans.Insert( key, pPlan );
+	}
+
+private:
+	CUtlHashtable< predcopyplankey_t, predcopyplan_t *, PredCopyPlanKeyHashFunctor > m_Plans;
+};
+
+static CPredictionCopyPlans g_PredictionCopyPlans;
+
+//-----------------------------------------------------------------------------
+// Purpose: Mirrors the field selection in CopyFields, recording what it would copy
+//  instead of copying it.
+//-----------------------------------------------------------------------------
+static void BuildCopyPlan_R( predcopyplan_t *pPlan, const predcopyplankey_t &key, int chain_count, 
+	typedescription_t *pFields, int fieldCount, int destBase, int srcBase )
+{
+	for ( int i = 0; i < fieldCount && pPlan->m_bUsable; i++ )
+	{
+		typedescription_t *pField = &pFields[ i ];
+		int flags = pField->flags;
+
+		if ( pField->override_field != NULL )
+		{
+			pField->override_field->override_count = chain_count;
+		}
+
+		if ( pField->override_count == chain_count )
+			continue;
+
+		if ( pField->fieldType != FIELD_EMBEDDED )
+		{
+			if ( flags & FTYPEDESC_PRIVATE )
+				continue;
+
+			if ( key.type == PC_NON_NETWORKED_ONLY && ( flags & FTYPEDESC_INSENDTABLE ) )
+				continue;
+
+			if ( key.type == PC_NETWORKED_ONLY && !( flags & FTYPEDESC_INSENDTABLE ) )
+				continue;
+		}
+
+		predcopyrun_t run;
+		run.destOffset = destBase + pField->fieldOffset[ key.destOffsetIndex ];
+		run.srcOffset = srcBase + pField->fieldOffset[ key.srcOffsetIndex ];
+		run.order = pPlan->m_Runs.Count();
+
+		int fieldSize = pField->fieldSize;
+
+		switch( pField->fieldType )
+		{
+		case FIELD_EMBEDDED:
+			// Pointers can only be followed with the object in hand
+			if ( ( flags & FTYPEDESC_PTR ) && 
+				( key.srcOffsetIndex == TD_OFFSET_NORMAL || key.destOffsetIndex == TD_OFFSET_NORMAL ) )
+			{
+				pPlan->m_bUsable = false;
+				return;
+			}
+			BuildCopyPlan_R( pPlan, key, chain_count, pField->td->dataDesc, pField->td->dataNumFields, run.destOffset, run.srcOffset );
+			continue;
+
+		case FIELD_FLOAT:		run.size = sizeof( float ) * fieldSize; break;
+		case FIELD_STRING:		run.size = -1; break;
+		case FIELD_VECTOR:		run.size = sizeof( Vector ) * fieldSize; break;
+		case FIELD_QUATERNION:	run.size = sizeof( Quaternion ) * fieldSize; break;
+		case FIELD_COLOR32:		run.size = 4 * fieldSize; break;
+		case FIELD_BOOLEAN:		run.size = sizeof( bool ) * fieldSize; break;
+		case FIELD_INTEGER:		run.size = sizeof( int ) * fieldSize; break;
+		case FIELD_SHORT:		run.size = sizeof( short ) * fieldSize; break;
+		case FIELD_CHARACTER:	run.size = fieldSize; break;
+		case FIELD_EHANDLE:		run.size = sizeof( EHANDLE ) * fieldSize; break;
+
+		default:
+			// Everything else is either empty or unsupported by prediction, and CopyFields
+			// doesn't copy it either
+			continue;
+		}
+
+		if ( run.size != 0 )
+		{
+			pPlan->m_Runs.AddToTail( run );
+		}
+	}
+}
+
+static int __cdecl CompareCopyRuns( const predcopyrun_t *a, const predcopyrun_t *b )
+{
+	if ( a->destOffset != b->destOffset )
+		return ( a->destOffset < b->destOffset ) ? -1 : 1;
+	return a->order - b->order;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Sorts the runs by destination and merges the ones that are contiguous on both sides
+//-----------------------------------------------------------------------------
+static void CoalesceCopyPlan( predcopyplan_t *pPlan )
+{
+	CUtlVector< predcopyrun_t > &runs = pPlan->m_Runs;
+	if ( runs.Count() < 2 )
+		return;
+
+	CUtlVector< predcopyrun_t > sorted;
+	sorted.AddMultipleToTail( runs.Count(), runs.Base() );
+	sorted.Sort( CompareCopyRuns );
+
+	// If two fields write the same bytes the walk order decides who wins, so leave it alone
+	for ( int i = 1; i < sorted.Count(); i++ )
+	{
+		const predcopyrun_t &prev = sorted[ i - 1 ];
+		if ( prev.size < 0 || sorted[ i ].size < 0 )
+			continue;
+		if ( prev.destOffset + prev.size > sorted[ i ].destOffset )
+			return;
+	}
+
+	runs.RemoveAll();
+	for ( int i = 0; i < sorted.Count(); i++ )
+	{
+		const predcopyrun_t &run = sorted[ i ];
+		if ( runs.Count() && run.size > 0 )
+		{
+			predcopyrun_t &last = runs.Tail();
+			if ( last.size > 0 &&
+				last.destOffset + last.size == run.destOffset &&
+				last.srcOffset + last.size == run.srcOffset )
+			{
+				last.size += run.size;
+				continue;
+			}
+		}
+		runs.AddToTail( run );
+	}
+}
+
+static predcopyplan_t *GetCopyPlan( datamap_t *dmap, int type, int destOffsetIndex, int srcOffsetIndex )
+{
+	predcopyplankey_t key;
+	key.dmap = dmap;
+	key.type = type;
+	key.destOffsetIndex = destOffsetIndex;
+	key.srcOffsetIndex = srcOffsetIndex;
+
+	predcopyplan_t *pPlan = g_PredictionCopyPlans.Find( key );
+	if ( pPlan )
+		return pPlan;
+
+	// Packed offsets are filled in lazily, don't bake in zeroes
+	if ( ( destOffsetIndex == TD_OFFSET_PACKED || srcOffsetIndex == TD_OFFSET_PACKED ) && !dmap->packed_offsets_computed )
+		return NULL;
+
+	pPlan = new predcopyplan_t;
+	pPlan->m_bUsable = true;
+
+	// Walk the same way TransferData_R does: this class first, then the baseclasses
+	int chain_count = ++g_nChainCount;
+	for ( datamap_t *pMap = dmap; pMap && pPlan->m_bUsable; pMap = pMap->baseMap )
+	{
+		BuildCopyPlan_R( pPlan, key, chain_count, pMap->dataDesc, pMap->dataNumFields, 0, 0 );
+	}
+
+	if ( pPlan->m_bUsable )
+	{
+		CoalesceCopyPlan( pPlan );
+	}
+	else
+	{
+		pPlan->m_Runs.Purge();
+	}
+
+	g_PredictionCopyPlans.Insert( key, pPlan );
+	return pPlan;
+}
+
+static void ExecuteCopyPlan( const predcopyplan_t *pPlan, void *dest, void const *src )
+{
+	const predcopyrun_t *pRun = pPlan->m_Runs.Base();
+	for ( int i = pPlan->m_Runs.Count(); --i >= 0; ++pRun )
+	{
+		char *pOut = (char *)dest + pRun->destOffset;
+		const char *pIn = (const char *)src + pRun->srcOffset;
+		int size = ( pRun->size >= 0 ) ? pRun->size : Q_strlen( pIn ) + 1;
+		memcpy( pOut, pIn, size );
+	}
+}
+
 //-----------------------------------------------------------------------------
 // Purpose: 
 // Input  : *operation - 
@@ -1391,6 +1641,17 @@ int CPredictionCopy::TransferData( const char *operation, int entindex, datamap_
 	
 	DetermineWatchField( operation, entindex, dmap );
 
+	// Straight copies don't need to look at the individual fields
+	if ( m_bPerformCopy && !m_bErrorCheck && !m_bDescribeFields && !m_FieldCompareFunc && !m_pWatchField && cl_pred_copyplans.GetBool() )
+	{
+		predcopyplan_t *pPlan = GetCopyPlan( dmap, m_nType, m_nDestOffsetIndex, m_nSrcOffsetIndex );
+		if ( pPlan && pPlan->m_bUsable )
+		{
+			ExecuteCopyPlan( pPlan, m_pDest, m_pSrc );
+			return m_nErrorCount;
+		}
+	}
+
 	TransferData_R( g_nChainCount, dmap );
 
 	return m_nErrorCount;
@@ -24,6 +24,7 @@
 #include "vphysics/object_hash.h"
 #include "datacache/imdlcache.h"
 #include "tier0/vprof.h"
+#include "tier1/generichash.h"
 
 #if !defined( CLIENT_DLL )
 
@@ -54,6 +55,38 @@ void AddRestoredEntity( C_BaseEntity *pEntity );
 
 ASSERT_INVARIANT( sizeof(EHandlePlaceholder_t) == sizeof(EHANDLE) );
 
+//-----------------------------------------------------------------------------
+// Field and block names are nearly always static strings, and the token table
+// keeps the pointer it was last handed for each symbol. Remember which symbol
+// a name pointer resolved to and reuse it while the table still holds that
+// exact pointer, skipping the hash and strcmp probe.
+//-----------------------------------------------------------------------------
+#define SAVE_SYMBOL_CACHE_SIZE	1024
+
+struct SaveSymbolCacheEntry_t
+{
+	const char		*pszToken;
+	unsigned short	symbol;
+};
+
+static SaveSymbolCacheEntry_t g_SaveSymbolCache[SAVE_SYMBOL_CACHE_SIZE];
+
+static unsigned short FindCreateSaveSymbol( CSaveRestoreSegment *pData, const char *pszToken )
+{
+	uintp key = (uintp)pszToken;
+	SaveSymbolCacheEntry_t &entry = g_SaveSymbolCache[ ( ( key >> 3 ) ^ ( key >> 13 ) ) & ( SAVE_SYMBOL_CACHE_SIZE - 1 ) ];
+
+	if ( entry.pszToken == pszToken && entry.symbol < pData->SizeSymbolTable() && 
+		 pData->StringFromSymbol( entry.symbol ) == pszToken )
+	{
+		return entry.symbol;
+	}
+
+	entry.pszToken = pszToken;
+	entry.symbol = pData->FindCreateSymbol( pszToken );
+	return entry.symbol;
+}
+
 //-----------------------------------------------------------------------------
 
 static int gSizes[FIELD_TYPECOUNT] = 
@@ -206,6 +239,12 @@ inline int CSave::DataEmpty( const char *pdata, int size )
 	if ( size != 4 )
 	{
 		const char *pLimit = pdata + size;
+		while ( pdata + sizeof(int) <= pLimit )
+		{
+			if ( *((int *)pdata) )
+				return 0;
+			pdata += sizeof(int);
+		}
 		while ( pdata < pLimit )
 		{
 			if ( *pdata++ )
@@ -930,7 +969,7 @@ void CSave::BufferField( const char *pname, int size, const char *pdata )
 void CSave::WriteHeader( const char *pname, int size )
 {
 	short shortSize = size;
-	short hashvalue = m_pData->FindCreateSymbol( pname );
+	short hashvalue = FindCreateSaveSymbol( m_pData, pname );
 	if ( size > SHRT_MAX || size < 0 )
 	{
 		Warning( "CSave::WriteHeader() size parameter exceeds 'short'!\n" );
@@ -1496,10 +1535,189 @@ bool CRestore::ShouldReadField( typedescription_t *pField )
 	return true;
 }
 
+//-------------------------------------
+// Purpose: Case-insensitive name -> field index table for one datadesc field
+//			array. Built the first time the array is restored and kept until
+//			the module unloads.
+//
+//			Tables are keyed by address, and not every field array is static:
+//			the CUtlVector/CUtlMap/CUtlRBTree data ops build one or two entry
+//			descriptions on the stack. Arrays that small are scanned linearly
+//			and never cached, and a cached table is checked against the array's
+//			count and field names before each use and rebuilt if they changed.
+//
+//			A name can appear more than once in a datadesc (e.g. a base class
+//			and a derived class both declaring m_foo). Fields sharing a name
+//			are kept in a ring, and the one picked is the first at or after the
+//			search cookie, wrapping around, exactly as the old linear search
+//			from the cookie did. Since fields are written in datadesc order,
+//			each saved copy is still read back into its own field.
+
+class CRestoreFieldLookup
+{
+public:
+	CRestoreFieldLookup( typedescription_t *pFields, int fieldCount )
+	 :	m_pFields( pFields ),
+		m_nFields( fieldCount )
+	{
+		m_FieldNames.SetCount( fieldCount );
+		for ( int i = 0; i < fieldCount; i++ )
+			m_FieldNames[i] = pFields[i].fieldName;
+
+		int nSlots = 8;
+		while ( nSlots < fieldCount * 2 )
+			nSlots <<= 1;
+		m_nMask = nSlots - 1;
+
+		m_Slots.SetCount( nSlots );
+		for ( int i = 0; i < nSlots; i++ )
+			m_Slots[i] = -1;
+
+		m_NextSameName.SetCount( fieldCount );
+		for ( int i = 0; i < fieldCount; i++ )
+		{
+			m_NextSameName[i] = i;
+
+			if ( !pFields[i].fieldName )
+				continue;
+
+			int iFirst = FindFirst( pFields[i].fieldName );
+			if ( iFirst != -1 )
+			{
+				// Append to the end of the ring, which stays in datadesc order
+				int iLast = iFirst;
+				while ( m_NextSameName[iLast] != iFirst )
+					iLast = m_NextSameName[iLast];
+				m_NextSameName[iLast] = i;
+				m_NextSameName[i] = iFirst;
+				continue;
+			}
+
+			unsigned iSlot = HashStringCaseless( pFields[i].fieldName ) & m_nMask;
+			while ( m_Slots[iSlot] != -1 )
+				iSlot = ( iSlot + 1 ) & m_nMask;
+			m_Slots[iSlot] = i;
+		}
+	}
+
+	// Is this table still describing pFields?
+	bool Matches( typedescription_t *pFields, int fieldCount ) const
+	{
+		if ( pFields != m_pFields || fieldCount != m_nFields )
+			return false;
+
+		for ( int i = 0; i < fieldCount; i++ )
+		{
+			if ( pFields[i].fieldName != m_FieldNames[i] )
+				return false;
+		}
+		return true;
+	}
+
+	typedescription_t *Find( const char *pszFieldName, int *pCookie ) const
+	{
+		int iField = FindFirst( pszFieldName );
+		if ( iField == -1 )
+		{
+			*pCookie = 0;
+			return NULL;
+		}
+
+		if ( m_NextSameName[iField] != iField )
+		{
+			// Pick the duplicate the cookie reaches first
+			int iBest = iField;
+			int nBestDist = ( iField - *pCookie + m_nFields ) % m_nFields;
+			for ( int i = m_NextSameName[iField]; i != iField; i = m_NextSameName[i] )
+			{
+				int nDist = ( i - *pCookie + m_nFields ) % m_nFields;
+				if ( nDist < nBestDist )
+				{
+					iBest = i;
+					nBestDist = nDist;
+				}
+			}
+			iField = iBest;
+		}
+
+		*pCookie = ( iField + 1 == m_nFields ) ? 0 : iField + 1;
+		return &m_pFields[iField];
+	}
+
+private:
+	int FindFirst( const char *pszFieldName ) const
+	{
+		unsigned iSlot = HashStringCaseless( pszFieldName ) & m_nMask;
+		while ( m_Slots[iSlot] != -1 )
+		{
+			if ( stricmp( m_pFields[ m_Slots[iSlot] ].fieldName, pszFieldName ) == 0 )
+				return m_Slots[iSlot];
+			iSlot = ( iSlot + 1 ) & m_nMask;
+		}
+		return -1;
+	}
+
+	typedescription_t *m_pFields;
+	int				m_nFields;
+	CUtlVector<short> m_Slots;
+	CUtlVector<short> m_NextSameName;
+	CUtlVector<const char *> m_FieldNames;
+	unsigned		m_nMask;
+};
+
+// Field arrays smaller than this are searched linearly and not cached
+#define RESTORE_FIELD_LOOKUP_MIN_FIELDS	8
+
+//-------------------------------------
+// Purpose: Owns the lookup tables so they are freed when the module unloads
+
+class CRestoreFieldLookupCache
+{
+public:
+	CRestoreFieldLookupCache()
+	 :	m_Lookups( DefLessFunc( typedescription_t * ) )
+	{
+	}
+
+	~CRestoreFieldLookupCache()
+	{
+		m_Lookups.PurgeAndDeleteElements();
+	}
+
+	CRestoreFieldLookup *Get( typedescription_t *pFields, int fieldCount )
+	{
+		if ( fieldCount < RESTORE_FIELD_LOOKUP_MIN_FIELDS )
+			return NULL;
+
+		unsigned short iLookup = m_Lookups.Find( pFields );
+		if ( iLookup != m_Lookups.InvalidIndex() )
+		{
+			if ( m_Lookups[iLookup]->Matches( pFields, fieldCount ) )
+				return m_Lookups[iLookup];
+
+			delete m_Lookups[iLookup];
+			m_Lookups[iLookup] = new CRestoreFieldLookup( pFields, fieldCount );
+			return m_Lookups[iLookup];
+		}
+
+		CRestoreFieldLookup *pLookup = new CRestoreFieldLookup( pFields, fieldCount );
+		m_Lookups.Insert( pFields, pLookup );
+		return pLookup;
+	}
+
+private:
+	CUtlMap<typedescription_t *, CRestoreFieldLookup *> m_Lookups;
+};
+
+static CRestoreFieldLookupCache g_RestoreFieldLookups;
+
 //-------------------------------------
 
-typedescription_t *CRestore::FindField( const char *pszFieldName, typedescription_t *pFields, int fieldCount, int *pCookie )
+typedescription_t *CRestore::FindField( const char *pszFieldName, typedescription_t *pFields, int fieldCount, CRestoreFieldLookup *pLookup, int *pCookie )
 {
+	if ( pLookup && pszFieldName )
+		return pLookup->Find( pszFieldName, pCookie );
+
 	int &fieldNumber = *pCookie;
 	if ( pszFieldName )
 	{
@@ -1632,7 +1850,7 @@ int CRestore::ReadFields( const char *pname, void *pBaseData, datamap_t *pRootMa
 {
 	static int lastName = -1;
 	Verify( ReadShort() == sizeof(int) );			// First entry should be an int
-	int symName = m_pData->FindCreateSymbol(pname);
+	int symName = FindCreateSaveSymbol( m_pData, pname );
 
 	// Check the struct name
 	int curSym = ReadShort();
@@ -1653,14 +1871,15 @@ int CRestore::ReadFields( const char *pname, void *pBaseData, datamap_t *pRootMa
 	// Skip over the struct name
 	int i;
 	int nFieldsSaved = ReadInt();						// Read field count
-	int searchCookie = 0;								// Make searches faster, most data is read/written in the same order
 	SaveRestoreRecordHeader_t header;
+	int searchCookie = 0;								// Resolves duplicate field names in the order they were written
+	CRestoreFieldLookup *pLookup = g_RestoreFieldLookups.Get( pFields, fieldCount );
 
 	for ( i = 0; i < nFieldsSaved; i++ )
 	{
 		ReadHeader( &header );
 
-		typedescription_t *pField = FindField( m_pData->StringFromSymbol( header.symbol ), pFields, fieldCount, &searchCookie);
+		typedescription_t *pField = FindField( m_pData->StringFromSymbol( header.symbol ), pFields, fieldCount, pLookup, &searchCookie );
 		if ( pField && ShouldReadField( pField ) )
 		{
 			ReadField( header, ((char *)pBaseData + pField->fieldOffset[ TD_OFFSET_NORMAL ]), pRootMap, pField );
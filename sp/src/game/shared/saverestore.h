@@ -23,6 +23,7 @@
 class CSaveRestoreData;
 class CSaveRestoreSegment;
 class CGameSaveRestoreInfo;
+class CRestoreFieldLookup;
 struct typedescription_t;
 struct edict_t;
 struct datamap_t;
@@ -275,7 +276,7 @@ private:
 	
 	int				DoReadAll( void *pLeafObject, datamap_t *pLeafMap, datamap_t *pCurMap );
 	
-	typedescription_t *FindField( const char *pszFieldName, typedescription_t *pFields, int fieldCount, int *pIterator );
+	typedescription_t *FindField( const char *pszFieldName, typedescription_t *pFields, int fieldCount, CRestoreFieldLookup *pLookup, int *pIterator );
 	void			ReadField( const SaveRestoreRecordHeader_t &header, void *pDest, datamap_t *pRootMap, typedescription_t *pField );
 	
 	void 			ReadBasicField( const SaveRestoreRecordHeader_t &header, void *pDest, datamap_t *pRootMap, typedescription_t *pField );
@@ -20,6 +20,8 @@
 #include "datamanager.h"
 #include "convar.h"
 #include "tier0/tslist.h"
+#include "utlhashtable.h"
+#include "generichash.h"
 #include "vphysics_interface.h"
 #ifdef CLIENT_DLL
 	#include "posedebugger.h"
@@ -883,10 +885,252 @@ static void CalcZeroframeData( const CStudioHdr *pStudioHdr, const studiohdr_t *
 
 
 
+//-----------------------------------------------------------------------------
+// Decoded animation cache
+//
+// Crowds of NPCs frequently play the same frame of the same sequence on the
+// same tick.  Instead of each of them decoding the RLE animation streams, the
+// first decode of a (model, sequence, animation, cycle, bonemask) is kept and
+// later ones are copied out of the cache.  Only decodes that depend on nothing
+// but the key are stored, so cached results are identical to a fresh decode.
+//-----------------------------------------------------------------------------
+static ConVar anim_decode_cache( "anim_decode_cache", "1", FCVAR_REPLICATED, "Share decoded animation frames between entities playing the same frame" );
+
+struct decodedanimkey_t
+{
+	const studiohdr_t	*pStudioHdr;
+	int					checksum;
+	int					sequence;
+	int					animation;
+	float				cycle;
+	int					boneMask;
+
+	bool operator==( const decodedanimkey_t &other ) const { return memcmp( this, &other, sizeof(*this) ) == 0; }
+};
+
+struct DecodedAnimKeyHashFunctor
+{
+	unsigned int operator()( const decodedanimkey_t &key ) const { return HashBlock( &key, sizeof(key) ); }
+};
+
+struct decodedanimparams_t
+{
+	const CStudioHdr	*pStudioHdr;
+	mstudioseqdesc_t	*pSeqdesc;
+	int					sequence;
+	int					boneMask;
+	const Vector		*pos;
+	const Quaternion	*q;
+};
+
+class CDecodedAnimation
+{
+public:
+	// you must implement these static functions for the ResourceManager
+	// -----------------------------------------------------------
+	static CDecodedAnimation *CreateResource( const decodedanimparams_t &params );
+	static unsigned int EstimatedSize( const decodedanimparams_t &params );
+	// -----------------------------------------------------------
+	// member functions that must be present for the ResourceManager
+	void				DestroyResource()	{ free( this ); }
+	CDecodedAnimation	*GetData()			{ return this; }
+	unsigned int		Size()				{ return m_size; }
+	// -----------------------------------------------------------
+
+	void				ReadBones( Vector *pos, Quaternion *q );
+
+private:
+	// pos, q and bone index arrays follow the object
+	Vector				*PosArray()		{ return (Vector *)( this + 1 ); }
+	Quaternion			*QuatArray()	{ return (Quaternion *)( PosArray() + m_boneCount ); }
+	short				*BoneArray()	{ return (short *)( QuatArray() + m_boneCount ); }
+
+	unsigned int		m_size;
+	int					m_boneCount;
+};
+
+//-----------------------------------------------------------------------------
+// Purpose: Fills out the list of bones CalcAnimation writes for this sequence
+//-----------------------------------------------------------------------------
+static int DecodedAnimationBones( const decodedanimparams_t &params, short *pBones )
+{
+	const CStudioHdr *pStudioHdr = params.pStudioHdr;
+	virtualmodel_t *pVModel = pStudioHdr->GetVirtualModel();
+	const virtualgroup_t *pSeqGroup = pVModel ? pVModel->pSeqGroup( params.sequence ) : NULL;
+	float *pweight = params.pSeqdesc->pBoneweight( 0 );
+
+	int nBoneCount = 0;
+	for ( int i = 0; i < pStudioHdr->numbones(); i++ )
+	{
+		if ( !( pStudioHdr->boneFlags(i) & params.boneMask ) )
+			continue;
+
+		int j = pSeqGroup ? pSeqGroup->boneMap[i] : i;
+		if ( j >= 0 && pweight[j] > 0.0f )
+		{
+			pBones[nBoneCount++] = i;
+		}
+	}
+	return nBoneCount;
+}
+
+CDecodedAnimation *CDecodedAnimation::CreateResource( const decodedanimparams_t &params )
+{
+	short bones[MAXSTUDIOBONES];
+	int nBoneCount = DecodedAnimationBones( params, bones );
+
+	unsigned int size = sizeof(CDecodedAnimation) + nBoneCount * ( sizeof(Vector) + sizeof(Quaternion) + sizeof(short) );
+	CDecodedAnimation *pMem = (CDecodedAnimation *)malloc( size );
+	pMem->m_size = size;
+	pMem->m_boneCount = nBoneCount;
+
+	Vector *pPos = pMem->PosArray();
+	Quaternion *pQ = pMem->QuatArray();
+	short *pBones = pMem->BoneArray();
+	for ( int i = 0; i < nBoneCount; i++ )
+	{
+		pBones[i] = bones[i];
+		pPos[i] = params.pos[bones[i]];
+		pQ[i] = params.q[bones[i]];
+	}
+	return pMem;
+}
+
+unsigned int CDecodedAnimation::EstimatedSize( const decodedanimparams_t &params )
+{
+	// conservative estimate - max size
+	return sizeof(CDecodedAnimation) + params.pStudioHdr->numbones() * ( sizeof(Vector) + sizeof(Quaternion) + sizeof(short) );
+}
+
+void CDecodedAnimation::ReadBones( Vector *pos, Quaternion *q )
+{
+	const Vector *pPos = PosArray();
+	const Quaternion *pQ = QuatArray();
+	const short *pBones = BoneArray();
+	for ( int i = 0; i < m_boneCount; i++ )
+	{
+		pos[pBones[i]] = pPos[i];
+		q[pBones[i]] = pQ[i];
+	}
+}
+
+class CDecodedAnimationCache
+{
+public:
+	CDecodedAnimationCache() : m_Cache( 512 * 1024L )
+	{
+		m_nHits = m_nMisses = m_nStores = 0;
+		m_nUncacheable = 0;
+	}
+
+	bool Read( const decodedanimkey_t &key, Vector *pos, Quaternion *q )
+	{
+		AUTO_LOCK( m_Cache.AccessMutex() );
+
+		UtlHashHandle_t h = m_Handles.Find( key );
+		if ( h != m_Handles.InvalidHandle() )
+		{
+			CDecodedAnimation *pDecoded = m_Cache.GetResource_NoLock( m_Handles[h] );
+			if ( pDecoded )
+			{
+				pDecoded->ReadBones( pos, q );
+				m_nHits++;
+				return true;
+			}
+
+			// evicted
+			m_Handles.Remove( key );
+		}
+
+		m_nMisses++;
+		return false;
+	}
+
+	void Store( const decodedanimkey_t &key, const decodedanimparams_t &params )
+	{
+		AUTO_LOCK( m_Cache.AccessMutex() );
+
+		// Another thread may have decoded the same frame meanwhile
+		if ( m_Handles.Find( key ) != m_Handles.InvalidHandle() )
+			return;
+
+		// Evicted entries only leave their handle behind; sweep them out
+		// before the table grows without bound
+		if ( m_Handles.Count() >= 4096 )
+		{
+			for ( UtlHashHandle_t it = m_Handles.FirstHandle(); it != m_Handles.InvalidHandle(); )
+			{
+				if ( !m_Cache.GetResource_NoLockNoLRUTouch( m_Handles[it] ) )
+				{
+					it = m_Handles.RemoveAndAdvance( it );
+				}
+				else
+				{
+					it = m_Handles.NextHandle( it );
+				}
+			}
+		}
+
+		m_Handles.Insert( key, m_Cache.CreateResource( params ) );
+		m_nStores++;
+	}
+
+	void NoteUncacheable()
+	{
+		++m_nUncacheable;
+	}
+
+	void Report()
+	{
+		AUTO_LOCK( m_Cache.AccessMutex() );
+
+		int nLookups = m_nHits + m_nMisses;
+		Msg( "Decoded animation cache: %d lookups, %d hits (%.1f%%), %d misses, %d stored, %d uncacheable\n",
+			nLookups, m_nHits, nLookups ? 100.0f * m_nHits / nLookups : 0.0f, m_nMisses, m_nStores, (int)m_nUncacheable );
+		Msg( "  %d entries, %u of %u bytes used\n", m_Handles.Count(), m_Cache.UsedSize(), m_Cache.TargetSize() );
+	}
+
+	void Flush()
+	{
+		AUTO_LOCK( m_Cache.AccessMutex() );
+		m_Cache.FlushAll();
+		m_Handles.RemoveAll();
+		m_nHits = m_nMisses = m_nStores = 0;
+		m_nUncacheable = 0;
+	}
+
+private:
+	CDataManager<CDecodedAnimation, decodedanimparams_t, CDecodedAnimation *, CThreadFastMutex> m_Cache;
+	CUtlHashtable<decodedanimkey_t, memhandle_t, DecodedAnimKeyHashFunctor> m_Handles;
+
+	int				m_nHits;
+	int				m_nMisses;
+	int				m_nStores;
+	CInterlockedInt	m_nUncacheable;
+};
+
+static CDecodedAnimationCache g_DecodedAnimationCache;
+
+#ifdef CLIENT_DLL
+CON_COMMAND( cl_anim_decode_cache_report, "Report client decoded animation cache statistics. Pass 'flush' to empty the cache afterwards." )
+#else
+CON_COMMAND( anim_decode_cache_report, "Report server decoded animation cache statistics. Pass 'flush' to empty the cache afterwards." )
+#endif
+{
+	g_DecodedAnimationCache.Report();
+	if ( args.ArgC() > 1 && !V_stricmp( args[1], "flush" ) )
+	{
+		g_DecodedAnimationCache.Flush();
+	}
+}
+
+
 //-----------------------------------------------------------------------------
 // Purpose: Find and decode a sub-frame of animation, remapping the skeleton bone indexes
+// Output : true if the result depends only on the model, sequence, animation,
+//			cycle and bonemask and so may be shared by the decoded animation cache
 //-----------------------------------------------------------------------------
-static void CalcVirtualAnimation( virtualmodel_t *pVModel, const CStudioHdr *pStudioHdr, Vector *pos, Quaternion *q, 
+static bool CalcVirtualAnimation( virtualmodel_t *pVModel, const CStudioHdr *pStudioHdr, Vector *pos, Quaternion *q, 
 	mstudioseqdesc_t &seqdesc, int sequence, int animation,
 	float cycle, int boneMask )
 {
@@ -962,7 +1206,7 @@ static void CalcVirtualAnimation( virtualmodel_t *pVModel, const CStudioHdr *pSt
 	if (!panim)
 	{
 		CalcZeroframeData( ((CStudioHdr *)pStudioHdr), pAnimStudioHdr, pAnimGroup, pAnimbone, animdesc, fFrame, pos, q, boneMask, 1.0 );
-		return;
+		return false;
 	}
 
 	// FIXME: change encoding so that bone -1 is never the case
@@ -1025,29 +1269,29 @@ static void CalcVirtualAnimation( virtualmodel_t *pVModel, const CStudioHdr *pSt
 
 		g_MatrixPool.Free( boneToWorld );
 	}
+
+	// Stalls are resolved once the animation block has loaded, and local
+	// hierarchies read bones outside of the sequence's weighted set
+	return ( flStall <= 0.0f && !animdesc.numlocalhierarchy );
 }
 
 
 
 //-----------------------------------------------------------------------------
 // Purpose: Find and decode a sub-frame of animation
+// Output : true if the result may be shared by the decoded animation cache
 //-----------------------------------------------------------------------------
 
-static void CalcAnimation( const CStudioHdr *pStudioHdr,	Vector *pos, Quaternion *q, 
+static bool DecodeAnimation( const CStudioHdr *pStudioHdr,	Vector *pos, Quaternion *q, 
 	mstudioseqdesc_t &seqdesc,
 	int sequence, int animation,
 	float cycle, int boneMask )
 {
-#ifdef STUDIO_ENABLE_PERF_COUNTERS
-	pStudioHdr->m_nPerfAnimationLayers++;
-#endif
-
 	virtualmodel_t *pVModel = pStudioHdr->GetVirtualModel();
 
 	if (pVModel)
 	{
-		CalcVirtualAnimation( pVModel, pStudioHdr, pos, q, seqdesc, sequence, animation, cycle, boneMask );
-		return;
+		return CalcVirtualAnimation( pVModel, pStudioHdr, pos, q, seqdesc, sequence, animation, cycle, boneMask );
 	}
 
 	mstudioanimdesc_t &animdesc = ((CStudioHdr *)pStudioHdr)->pAnimdesc( animation );
@@ -1093,7 +1337,7 @@ static void CalcAnimation( const CStudioHdr *pStudioHdr,	Vector *pos, Quaternion
 
 		CalcZeroframeData( pStudioHdr, pStudioHdr->GetRenderHdr(), NULL, pStudioHdr->pBone( 0 ), animdesc, fFrame, pos, q, boneMask, 1.0 );
 
-		return;
+		return false;
 	}
 
 	// BUGBUG: the sequence, the anim, and the model can have all different bone mappings.
@@ -1161,6 +1405,56 @@ static void CalcAnimation( const CStudioHdr *pStudioHdr,	Vector *pos, Quaternion
 		g_MatrixPool.Free( boneToWorld );
 	}
 
+	return ( flStall <= 0.0f && !animdesc.numlocalhierarchy );
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Find and decode a sub-frame of animation, sharing the result with
+//			any other entity that plays the same frame
+//-----------------------------------------------------------------------------
+
+static void CalcAnimation( const CStudioHdr *pStudioHdr,	Vector *pos, Quaternion *q, 
+	mstudioseqdesc_t &seqdesc,
+	int sequence, int animation,
+	float cycle, int boneMask )
+{
+#ifdef STUDIO_ENABLE_PERF_COUNTERS
+	pStudioHdr->m_nPerfAnimationLayers++;
+#endif
+
+	if ( !anim_decode_cache.GetBool() )
+	{
+		DecodeAnimation( pStudioHdr, pos, q, seqdesc, sequence, animation, cycle, boneMask );
+		return;
+	}
+
+	decodedanimkey_t key;
+	memset( &key, 0, sizeof(key) );
+	key.pStudioHdr = pStudioHdr->GetRenderHdr();
+	key.checksum = key.pStudioHdr->checksum;
+	key.sequence = sequence;
+	key.animation = animation;
+	key.cycle = cycle;
+	key.boneMask = boneMask;
+
+	if ( g_DecodedAnimationCache.Read( key, pos, q ) )
+		return;
+
+	if ( !DecodeAnimation( pStudioHdr, pos, q, seqdesc, sequence, animation, cycle, boneMask ) )
+	{
+		g_DecodedAnimationCache.NoteUncacheable();
+		return;
+	}
+
+	decodedanimparams_t params;
+	params.pStudioHdr = pStudioHdr;
+	params.pSeqdesc = &seqdesc;
+	params.sequence = sequence;
+	params.boneMask = boneMask;
+	params.pos = pos;
+	params.q = q;
+	g_DecodedAnimationCache.Store( key, params );
 }
 
 
@@ -1372,6 +1666,118 @@ void WorldSpaceSlerp(
 
 
 
+#ifdef _DEBUG
+//-----------------------------------------------------------------------------
+// Purpose: The per bone position blend SlerpBones and BlendBones used to do,
+//			kept to check BlendBonePositions against.  Bones with a weight of
+//			zero or less are skipped; like the quaternion loops, a NaN weight
+//			is not <= 0 and is blended.
+//-----------------------------------------------------------------------------
+static void BlendBonePositionsScalar( Vector *pos1, const Vector *pos2, const float *pS2, int nBoneCount, bool bDelta )
+{
+	for ( int i = 0; i < nBoneCount; i++ )
+	{
+		float s2 = pS2[i];
+		if ( s2 <= 0.0f )
+			continue;
+
+		if ( bDelta )
+		{
+			pos1[i][0] = pos1[i][0] + pos2[i][0] * s2;
+			pos1[i][1] = pos1[i][1] + pos2[i][1] * s2;
+			pos1[i][2] = pos1[i][2] + pos2[i][2] * s2;
+		}
+		else
+		{
+			float s1 = 1.0 - s2;
+			pos1[i][0] = pos1[i][0] * s1 + pos2[i][0] * s2;
+			pos1[i][1] = pos1[i][1] * s1 + pos2[i][1] * s2;
+			pos1[i][2] = pos1[i][2] * s1 + pos2[i][2] * s2;
+		}
+	}
+}
+#endif
+
+//-----------------------------------------------------------------------------
+// Purpose: Blend bone positions four floats at a time.  For every bone whose
+//			weight in pS2 is not <= 0:
+//				pos1 = pos1 * (1 - s2) + pos2 * s2	(normal blend)
+//				pos1 = pos1 + pos2 * s2				(bDelta)
+//			Other bones are left untouched.  The position arrays are treated as
+//			flat float arrays with the weights spread out to match, so no
+//			swizzling is needed.  Each float gets the same single precision
+//			multiplies and adds as BlendBonePositionsScalar, behind the same
+//			skip test, so the results match it exactly apart from which NaN
+//			comes out when a result is NaN.  (The scalar 1 - s2 is done in
+//			double and rounded, which gives the same float as the single
+//			precision subtract.)  Debug builds check this.
+//-----------------------------------------------------------------------------
+static void BlendBonePositions( Vector *pos1, const Vector *pos2, const float *pS2, int nBoneCount, bool bDelta )
+{
+#ifdef _DEBUG
+	Vector *pCheck = (Vector *)stackalloc( nBoneCount * sizeof(Vector) );
+	memcpy( pCheck, pos1, nBoneCount * sizeof(Vector) );
+	BlendBonePositionsScalar( pCheck, pos2, pS2, nBoneCount, bDelta );
+#endif
+
+	int nFloats = nBoneCount * 3;
+	float *pWeights = (float *)stackalloc( nFloats * sizeof(float) );
+	for ( int i = 0; i < nBoneCount; i++ )
+	{
+		pWeights[i*3] = pWeights[i*3+1] = pWeights[i*3+2] = pS2[i];
+	}
+
+	float *p1 = pos1[0].Base();
+	const float *p2 = pos2[0].Base();
+
+	int k = 0;
+	for ( ; k + 4 <= nFloats; k += 4 )
+	{
+		fltx4 s2 = LoadUnalignedSIMD( &pWeights[k] );
+		fltx4 skip = CmpLeSIMD( s2, Four_Zeros );
+		if ( TestSignSIMD( skip ) == 0xf )
+			continue;
+
+		fltx4 s1 = bDelta ? Four_Ones : SubSIMD( Four_Ones, s2 );
+		fltx4 a = LoadUnalignedSIMD( &p1[k] );
+		fltx4 b = LoadUnalignedSIMD( &p2[k] );
+
+		// Skipped bones may hold garbage in pos2, so mask them out rather
+		// than relying on the zero weight
+		StoreUnalignedSIMD( &p1[k], MaskedAssign( skip, a, AddSIMD( MulSIMD( a, s1 ), MulSIMD( b, s2 ) ) ) );
+	}
+
+	for ( ; k < nFloats; k++ )
+	{
+		float s2 = pWeights[k];
+		if ( s2 <= 0.0f )
+			continue;
+
+		if ( bDelta )
+		{
+			p1[k] = p1[k] + p2[k] * s2;
+		}
+		else
+		{
+			float s1 = 1.0 - s2;
+			p1[k] = p1[k] * s1 + p2[k] * s2;
+		}
+	}
+
+#ifdef _DEBUG
+	const float *pExpected = pCheck[0].Base();
+	for ( k = 0; k < nFloats; k++ )
+	{
+		uint32 nResult = *(const uint32 *)&p1[k];
+		uint32 nExpected = *(const uint32 *)&pExpected[k];
+		bool bBothNaN = ( nResult & 0x7fffffff ) > 0x7f800000 && ( nExpected & 0x7fffffff ) > 0x7f800000;
+		Assert( bBothNaN || nResult == nExpected );
+	}
+#endif
+}
+
+
+
 //-----------------------------------------------------------------------------
 // Purpose: blend together q1,pos1 with q2,pos2.  Return result in q1,pos1.  
 //			0 returns q1, pos1.  1 returns q2, pos2
@@ -1456,10 +1862,6 @@ void SlerpBones(
 				fltx4 result = QuaternionMASIMD( q1simd, s2, q2simd );
 				StoreUnalignedSIMD( q1[i].Base(), result );
 #endif
-				// FIXME: are these correct?
-				pos1[i][0] = pos1[i][0] + pos2[i][0] * s2;
-				pos1[i][1] = pos1[i][1] + pos2[i][1] * s2;
-				pos1[i][2] = pos1[i][2] + pos2[i][2] * s2;
 			}
 			else
 			{
@@ -1471,13 +1873,11 @@ void SlerpBones(
 				fltx4 result = QuaternionSMSIMD( s2, q2simd, q1simd );
 				StoreUnalignedSIMD( q1[i].Base(), result );
 #endif
-
-				// FIXME: are these correct?
-				pos1[i][0] = pos1[i][0] + pos2[i][0] * s2;
-				pos1[i][1] = pos1[i][1] + pos2[i][1] * s2;
-				pos1[i][2] = pos1[i][2] + pos2[i][2] * s2;
 			}
 		}
+
+		// FIXME: are these correct?
+		BlendBonePositions( pos1, pos2, pS2, nBoneCount, true );
 		return;
 	}
 
@@ -1520,11 +1920,9 @@ void SlerpBones(
 #else
 		StoreUnalignedSIMD( q1[i].Base(), result );
 #endif
-
-		pos1[i][0] = pos1[i][0] * s1 + pos2[i][0] * s2;
-		pos1[i][1] = pos1[i][1] * s1 + pos2[i][1] * s2;
-		pos1[i][2] = pos1[i][2] * s1 + pos2[i][2] * s2;
 	}
+
+	BlendBonePositions( pos1, pos2, pS2, nBoneCount, false );
 }
 
 
@@ -1592,8 +1990,12 @@ void BlendBones(
 	float s2 = s;
 	float s1 = 1.0 - s2;
 
-	for (i = 0; i < pStudioHdr->numbones(); i++)
+	int nBoneCount = pStudioHdr->numbones();
+	float *pS2 = (float*)stackalloc( nBoneCount * sizeof(float) );
+	for (i = 0; i < nBoneCount; i++)
 	{
+		pS2[i] = 0.0f;
+
 		// skip unused bones
 		if (!(pStudioHdr->boneFlags(i) & boneMask))
 		{
@@ -1623,11 +2025,11 @@ void BlendBones(
 			q1[i][1] = q3[1];
 			q1[i][2] = q3[2];
 			q1[i][3] = q3[3];
-			pos1[i][0] = pos1[i][0] * s1 + pos2[i][0] * s2;
-			pos1[i][1] = pos1[i][1] * s1 + pos2[i][1] * s2;
-			pos1[i][2] = pos1[i][2] * s1 + pos2[i][2] * s2;
+			pS2[i] = s2;
 		}
 	}
+
+	BlendBonePositions( pos1, pos2, pS2, nBoneCount, false );
 }
 
 
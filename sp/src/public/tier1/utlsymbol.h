@@ -85,8 +85,19 @@ protected:
 //    of strings to symbols and back. The symbol class itself contains
 //    a static version of this class for creating global strings, but this
 //    class can also be instanced to create local symbol tables.
+//
+//    Symbols are handed out in insertion order. Strings are found through an
+//    open-addressed hash of symbol ids kept in a separately allocated index;
+//    neither the strings nor the id->string blocks ever move once written, and
+//    a grown hash replaces the old one in a single pointer store, so lookups
+//    can run alongside a single writer.
+//
+//    NOTE: The member layout must not change. Prebuilt static libraries
+//    (dmxloader) were compiled against it and define tables of this size.
 //-----------------------------------------------------------------------------
 
+struct UtlSymbolHashIndex_t;
+
 class CUtlSymbolTable
 {
 public:
@@ -139,15 +150,15 @@ protected:
 	public:
 		CLess( int ignored = 0 ) {} // permits default initialization to NULL in CUtlRBTree
 		bool operator!() const { return false; }
-		bool operator()( const CStringPoolIndex &left, const CStringPoolIndex &right ) const;
 	};
 
-	// Stores the symbol lookup
+	// No longer holds any nodes; it's kept for the layout and its element
+	// count mirrors the number of symbols so GetNumStrings stays valid.
 	class CTree : public CUtlRBTree<CStringPoolIndex, unsigned short, CLess>
 	{
 	public:
 		CTree(  int growSize, int initSize ) : CUtlRBTree<CStringPoolIndex, unsigned short, CLess>( growSize, initSize ) {}
-		friend class CUtlSymbolTable::CLess; // Needed to allow CLess to calculate pointer to symbol table
+		void SetNumElements( unsigned short nElements ) { m_NumElements = nElements; }
 	};
 
 	struct StringPool_t
@@ -159,16 +170,15 @@ protected:
 
 	CTree m_Lookup;
 	bool m_bInsensitive;
-	mutable const char* m_pUserSearchString;
+	UtlSymbolHashIndex_t * volatile m_pHashIndex;	// allocated on the first AddString
 
 	// stores the string data
 	CUtlVector<StringPool_t*> m_StringPools;
 
 private:
 	int FindPoolWithSpace( int len ) const;
-	const char* StringFromIndex( const CStringPoolIndex &index ) const;
-
-	friend class CLess;
+	unsigned HashString( const char *pString ) const;
+	UtlSymId_t FindWithHash( const char *pString, unsigned nHash ) const;
 };
 
 class CUtlSymbolTableMT : private CUtlSymbolTable
@@ -179,28 +189,27 @@ public:
 	{
 	}
 
+	// Writers are serialized; lookups don't take the lock (see CUtlSymbolTable)
 	CUtlSymbol AddString( const char* pString )
 	{
+		CUtlSymbol result = CUtlSymbolTable::Find( pString );
+		if ( result.IsValid() )
+			return result;
+
 		m_lock.LockForWrite();
-		CUtlSymbol result = CUtlSymbolTable::AddString( pString );
+		result = CUtlSymbolTable::AddString( pString );
 		m_lock.UnlockWrite();
 		return result;
 	}
 
 	CUtlSymbol Find( const char* pString ) const
 	{
-		m_lock.LockForRead();
-		CUtlSymbol result = CUtlSymbolTable::Find( pString );
-		m_lock.UnlockRead();
-		return result;
+		return CUtlSymbolTable::Find( pString );
 	}
 
 	const char* String( CUtlSymbol id ) const
 	{
-		m_lock.LockForRead();
-		const char *pszResult = CUtlSymbolTable::String( id );
-		m_lock.UnlockRead();
-		return pszResult;
+		return CUtlSymbolTable::String( id );
 	}
 	
 private:
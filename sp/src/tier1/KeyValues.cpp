@@ -28,6 +28,8 @@
 #include "utlhash.h"
 #include "UtlSortVector.h"
 #include "convar.h"
+#include "checksum_crc.h"
+#include "tier0/icommandline.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include <tier0/memdbgon.h>
@@ -518,6 +520,117 @@ const char *KeyValues::GetName( void ) const
 	return s_pfGetStringForSymbol( m_iKeyName );
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: Reads a token straight out of the buffer's memory when the rest of
+//			a text buffer is resident, rather than a character at a time through
+//			the CUtlBuffer accessors. Returns false without consuming the token
+//			for anything unusual (escapes, unterminated strings, comments or
+//			whitespace running to the end) so ReadToken can handle it.
+//-----------------------------------------------------------------------------
+static bool ReadTokenInPlace( CUtlBuffer &buf, CUtlCharConversion *pConv, bool &wasQuoted, bool &wasConditional )
+{
+	int nRemaining = buf.GetBytesRemaining();
+	if ( !buf.IsText() || nRemaining <= 0 )
+		return false;
+
+	const char *pStart = (const char *)buf.PeekGet( nRemaining, 0 );
+	if ( !pStart )
+		return false;
+
+	const char *pEnd = pStart + nRemaining;
+	const char *p = pStart;
+
+	// eat white spaces and remarks
+	while ( true )
+	{
+		while ( p < pEnd && isspace( *(const unsigned char *)p ) )
+			++p;
+
+		if ( ( pEnd - p < 2 ) || ( p[0] != '/' ) || ( p[1] != '/' ) )
+			break;
+
+		const char *pEndOfLine = (const char *)memchr( p + 2, '\n', pEnd - p - 2 );
+		if ( !pEndOfLine )
+			break;
+		p = pEndOfLine + 1;
+	}
+
+	buf.SeekGet( CUtlBuffer::SEEK_CURRENT, p - pStart );
+	if ( p >= pEnd || ( p[0] == '/' && p + 1 < pEnd && p[1] == '/' ) )
+		return false;
+
+	// quoted strings without escapes are copied directly
+	if ( *p == '\"' )
+	{
+		const char *pString = p + 1;
+		const char *pClose = pString;
+		char nEscapeChar = pConv->GetEscapeChar();
+		while ( pClose < pEnd && *pClose != '\"' )
+		{
+			if ( *pClose == nEscapeChar )
+				return false;
+			++pClose;
+		}
+
+		if ( pClose >= pEnd )
+			return false;
+
+		int nLength = MIN( pClose - pString, KEYVALUES_TOKEN_SIZE - 1 );
+		memcpy( s_pTokenBuf, pString, nLength );
+		s_pTokenBuf[nLength] = 0;
+		wasQuoted = true;
+		buf.SeekGet( CUtlBuffer::SEEK_CURRENT, ( pClose + 1 ) - p );
+		return true;
+	}
+
+	if ( *p == '{' || *p == '}' )
+	{
+		s_pTokenBuf[0] = *p;
+		s_pTokenBuf[1] = 0;
+		buf.SeekGet( CUtlBuffer::SEEK_CURRENT, 1 );
+		return true;
+	}
+
+	// read in the token until we hit a whitespace or a control character
+	bool bReportedError = false;
+	bool bConditionalStart = false;
+	int nCount = 0;
+	const char *c = p;
+	for ( ; c < pEnd; ++c )
+	{
+		if ( *c == 0 )
+			break;
+
+		if ( *c == '"' || *c == '{' || *c == '}' )
+			break;
+
+		if ( *c == '[' )
+			bConditionalStart = true;
+
+		if ( *c == ']' && bConditionalStart )
+		{
+			wasConditional = true;
+		}
+
+		if ( isspace(*c) )
+			break;
+
+		if ( nCount < (KEYVALUES_TOKEN_SIZE-1) )
+		{
+			s_pTokenBuf[nCount++] = *c;
+		}
+		else if ( !bReportedError )
+		{
+			bReportedError = true;
+			g_KeyValuesErrorStack.ReportError(" ReadToken overflow" );
+		}
+	}
+	s_pTokenBuf[ nCount ] = 0;
+	buf.SeekGet( CUtlBuffer::SEEK_CURRENT, c - p );
+	return true;
+}
+
+
 //-----------------------------------------------------------------------------
 // Purpose: Read a single token from buffer (0 terminated)
 //-----------------------------------------------------------------------------
@@ -530,6 +643,9 @@ const char *KeyValues::ReadToken( CUtlBuffer &buf, bool &wasQuoted, bool &wasCon
 	if ( !buf.IsValid() )
 		return NULL; 
 
+	if ( ReadTokenInPlace( buf, m_bHasEscapeSequences ? GetCStringCharConversion() : GetNoEscCharConversion(), wasQuoted, wasConditional ) )
+		return s_pTokenBuf;
+
 	// eating white spaces and remarks loop
 	while ( true )
 	{
@@ -627,6 +743,144 @@ void KeyValues::UsesConditionals(bool state)
 }
 
 
+//-----------------------------------------------------------------------------
+// Binary cache for large script files. The first load of a file parses the
+// text and writes the resulting tree out with WriteAsBinary; later loads check
+// the cache against the source file and rebuild the tree with ReadAsBinary
+// instead of re-tokenizing it. Run with -nokvcache to disable.
+//-----------------------------------------------------------------------------
+#define KEYVALUES_CACHE_ID				(('C'<<24)+('V'<<16)+('K'<<8)+'B')
+#define KEYVALUES_CACHE_VERSION			1
+#define KEYVALUES_CACHE_DIRECTORY		"kvcache"
+#define KEYVALUES_CACHE_PATHID			"DEFAULT_WRITE_PATH"
+#define KEYVALUES_CACHE_MIN_FILE_SIZE	( 16 * 1024 )
+
+struct KeyValuesCacheKey_t
+{
+	int		m_nFlags;
+	int		m_nSourceSize;
+	int64	m_nSourceTime;
+	CRC32_t	m_SourceCRC;
+};
+
+static bool IsKeyValuesCacheEnabled()
+{
+	static int s_nEnabled = -1;
+	if ( s_nEnabled < 0 )
+	{
+		s_nEnabled = ( IsPC() && !CommandLine()->FindParm( "-nokvcache" ) ) ? 1 : 0;
+	}
+	return s_nEnabled != 0;
+}
+
+static void GetKeyValuesCacheFileName( const char *resourceName, const char *pathID, char *pOut, int nOutSize )
+{
+	char key[ MAX_PATH * 2 ];
+	Q_snprintf( key, sizeof( key ), "%s|%s", resourceName, pathID ? pathID : "" );
+	Q_FixSlashes( key );
+	Q_strlower( key );
+	Q_snprintf( pOut, nOutSize, "%s/%08x.kvc", KEYVALUES_CACHE_DIRECTORY, CRC32_ProcessSingleBuffer( key, Q_strlen( key ) ) );
+}
+
+// Text files only produce strings, ints, floats, uint64s and subkeys; anything
+// else would not survive the binary round trip, so such trees aren't cached.
+static bool CanCacheKeyValues( KeyValues *pKV )
+{
+	for ( ; pKV; pKV = pKV->GetNextKey() )
+	{
+		switch ( pKV->GetDataType() )
+		{
+		case KeyValues::TYPE_NONE:
+			if ( !CanCacheKeyValues( pKV->GetFirstSubKey() ) )
+				return false;
+			break;
+
+		case KeyValues::TYPE_STRING:
+		case KeyValues::TYPE_INT:
+		case KeyValues::TYPE_FLOAT:
+		case KeyValues::TYPE_UINT64:
+		case KeyValues::TYPE_COLOR:
+			break;
+
+		default:
+			return false;
+		}
+	}
+	return true;
+}
+
+// ReadAsBinary creates keys with default parse flags; match what the text
+// parser would have propagated from the root.
+static void SetKeyValuesParseFlags( KeyValues *pKV, bool bEscapeSequences, bool bConditionals )
+{
+	for ( ; pKV; pKV = pKV->GetNextKey() )
+	{
+		pKV->UsesEscapeSequences( bEscapeSequences );
+		pKV->UsesConditionals( bConditionals );
+		SetKeyValuesParseFlags( pKV->GetFirstSubKey(), bEscapeSequences, bConditionals );
+	}
+}
+
+static bool ReadKeyValuesCache( KeyValues *pKV, IFileSystem *filesystem, const char *pCacheName, const char *resourceName, const KeyValuesCacheKey_t &key )
+{
+	CUtlBuffer cache;
+	if ( !filesystem->ReadFile( pCacheName, KEYVALUES_CACHE_PATHID, cache ) )
+		return false;
+
+	if ( cache.GetInt() != KEYVALUES_CACHE_ID || cache.GetInt() != KEYVALUES_CACHE_VERSION )
+		return false;
+
+	if ( cache.GetInt() != key.m_nFlags || cache.GetInt() != key.m_nSourceSize || 
+		cache.GetInt64() != key.m_nSourceTime || cache.GetUnsignedInt() != key.m_SourceCRC )
+		return false;
+
+	char cachedName[ MAX_PATH ];
+	cache.GetString( cachedName, sizeof( cachedName ) );
+	if ( !cache.IsValid() || Q_stricmp( cachedName, resourceName ) )
+		return false;
+
+	int nDataSize = cache.GetInt();
+	CRC32_t dataCRC = cache.GetUnsignedInt();
+	if ( !cache.IsValid() || nDataSize <= 0 || nDataSize != cache.GetBytesRemaining() )
+		return false;
+
+	const void *pData = cache.PeekGet( nDataSize, 0 );
+	if ( !pData || CRC32_ProcessSingleBuffer( pData, nDataSize ) != dataCRC )
+		return false;
+
+	CUtlBuffer data( pData, nDataSize, CUtlBuffer::READ_ONLY );
+	return pKV->ReadAsBinary( data ) && data.GetBytesRemaining() == 0;
+}
+
+static void WriteKeyValuesCache( KeyValues *pKV, IFileSystem *filesystem, const char *pCacheName, const char *resourceName, const KeyValuesCacheKey_t &key )
+{
+	if ( !CanCacheKeyValues( pKV ) )
+		return;
+
+	CUtlBuffer data;
+	if ( !pKV->WriteAsBinary( data ) )
+		return;
+
+	CUtlBuffer cache;
+	cache.PutInt( KEYVALUES_CACHE_ID );
+	cache.PutInt( KEYVALUES_CACHE_VERSION );
+	cache.PutInt( key.m_nFlags );
+	cache.PutInt( key.m_nSourceSize );
+	cache.PutInt64( key.m_nSourceTime );
+	cache.PutUnsignedInt( key.m_SourceCRC );
+	cache.PutString( resourceName );
+	cache.PutInt( data.TellPut() );
+	cache.PutUnsignedInt( CRC32_ProcessSingleBuffer( data.Base(), data.TellPut() ) );
+	cache.Put( data.Base(), data.TellPut() );
+
+	filesystem->CreateDirHierarchy( KEYVALUES_CACHE_DIRECTORY, KEYVALUES_CACHE_PATHID );
+	if ( !filesystem->WriteFile( pCacheName, KEYVALUES_CACHE_PATHID, cache ) )
+	{
+		DevMsg( 2, "KeyValues::LoadFromFile: couldn't write cache \"%s\" for \"%s\".\n", pCacheName, resourceName );
+	}
+}
+
+
 //-----------------------------------------------------------------------------
 // Purpose: Load keyValues from disk
 //-----------------------------------------------------------------------------
@@ -658,7 +912,58 @@ bool KeyValues::LoadFromFile( IBaseFileSystem *filesystem, const char *resourceN
 	{
 		buffer[fileSize] = 0; // null terminate file as EOF
 		buffer[fileSize+1] = 0; // double NULL terminating in case this is a unicode file
-		bRetOK = LoadFromBuffer( resourceName, buffer, filesystem );
+
+		// only cache plain text files loaded into an empty key; includes pull
+		// in other files the cache key knows nothing about
+		bool bUseCache = fileSize >= KEYVALUES_CACHE_MIN_FILE_SIZE && 
+			IsKeyValuesCacheEnabled() && 
+			!m_pSub && !m_pPeer && m_iDataType == TYPE_NONE && 
+			Q_strlen( resourceName ) < MAX_PATH && 
+			!( (uint8)buffer[0] == 0xFF && (uint8)buffer[1] == 0xFE ) && 
+			!Q_stristr( buffer, "#include" ) && !Q_stristr( buffer, "#base" );
+
+		if ( bUseCache )
+		{
+			IFileSystem *pFileSystem = (IFileSystem *)filesystem;
+
+			KeyValuesCacheKey_t key;
+			key.m_nFlags = ( m_bHasEscapeSequences ? 1 : 0 ) | ( m_bEvaluateConditionals ? 2 : 0 ) | 
+				( IsWindows() ? 4 : 0 ) | ( IsLinux() ? 8 : 0 ) | ( IsOSX() ? 16 : 0 );
+			key.m_nSourceSize = fileSize;
+			key.m_nSourceTime = filesystem->GetFileTime( resourceName, pathID );
+			key.m_SourceCRC = CRC32_ProcessSingleBuffer( buffer, fileSize );
+
+			char cacheName[ MAX_PATH ];
+			GetKeyValuesCacheFileName( resourceName, pathID, cacheName, sizeof( cacheName ) );
+
+			// ReadAsBinary resets the key, so hang on to what the caller set up
+			int iKeyName = m_iKeyName;
+			bool bEscapeSequences = m_bHasEscapeSequences != 0;
+			bool bConditionals = m_bEvaluateConditionals != 0;
+
+			if ( ReadKeyValuesCache( this, pFileSystem, cacheName, resourceName, key ) )
+			{
+				SetKeyValuesParseFlags( this, bEscapeSequences, bConditionals );
+			}
+			else
+			{
+				RemoveEverything();
+				Init();
+				m_iKeyName = iKeyName;
+				UsesEscapeSequences( bEscapeSequences );
+				UsesConditionals( bConditionals );
+
+				bRetOK = LoadFromBuffer( resourceName, buffer, filesystem );
+				if ( bRetOK )
+				{
+					WriteKeyValuesCache( this, pFileSystem, cacheName, resourceName, key );
+				}
+			}
+		}
+		else
+		{
+			bRetOK = LoadFromBuffer( resourceName, buffer, filesystem );
+		}
 	}
 
 	((IFileSystem *)filesystem)->FreeOptimalReadBuffer( buffer );
@@ -2341,18 +2646,29 @@ void KeyValues::RecursiveLoadFromBuffer( char const *resourceName, CUtlBuffer &b
 			char* pFEnd;	// pos where float scan ended
 			const char* pSEnd = value + len ; // pos where token ends
 
-			int ival = strtol( value, &pIEnd, 10 );
-			float fval = (float)strtod( value, &pFEnd );
-			bool bOverflow = ( ival == LONG_MAX || ival == LONG_MIN ) && errno == ERANGE;
-#ifdef POSIX
-			// strtod supports hex representation in strings under posix but we DON'T
-			// want that support in keyvalues, so undo it here if needed
-			if ( len > 1 &&  tolower(value[1]) == 'x' )
+			int ival = 0;
+			float fval = 0.0f;
+			bool bOverflow = false;
+			pIEnd = pFEnd = (char *)value;
+
+			// Most values are names and paths that can't possibly be numbers, so don't bother
+			// converting them. strtod also takes "inf", "infinity" and "nan", so those still go through.
+			unsigned char cFirst = (unsigned char)value[0];
+			if ( !isalpha( cFirst ) || tolower( cFirst ) == 'i' || tolower( cFirst ) == 'n' )
 			{
-				fval = 0.0f;
-				pFEnd = (char *)value;
-			}
+				ival = strtol( value, &pIEnd, 10 );
+				fval = (float)strtod( value, &pFEnd );
+				bOverflow = ( ival == LONG_MAX || ival == LONG_MIN ) && errno == ERANGE;
+#ifdef POSIX
+				// strtod supports hex representation in strings under posix but we DON'T
+				// want that support in keyvalues, so undo it here if needed
+				if ( len > 1 &&  tolower(value[1]) == 'x' )
+				{
+					fval = 0.0f;
+					pFEnd = (char *)value;
+				}
 #endif
+			}
 				
 			if ( *value == 0 )
 			{
@@ -2464,7 +2780,14 @@ bool KeyValues::WriteAsBinary( CUtlBuffer &buffer )
 		{
 		case TYPE_NONE:
 			{
-				dat->m_pSub->WriteAsBinary( buffer );
+				if ( dat->m_pSub )
+				{
+					dat->m_pSub->WriteAsBinary( buffer );
+				}
+				else
+				{
+					buffer.PutUnsignedChar( TYPE_NUMTYPES );
+				}
 				break;
 			}
 		case TYPE_STRING:
@@ -2566,6 +2889,14 @@ bool KeyValues::ReadAsBinary( CUtlBuffer &buffer, int nStackDepth )
 		{
 		case TYPE_NONE:
 			{
+				// an empty subkey list comes back as no subkeys, not one unnamed key
+				const unsigned char *pNext = (const unsigned char *)buffer.PeekGet( sizeof(unsigned char), 0 );
+				if ( pNext && *pNext == TYPE_NUMTYPES )
+				{
+					buffer.GetUnsignedChar();
+					break;
+				}
+
 				dat->m_pSub = new KeyValues("");
 				dat->m_pSub->ReadAsBinary( buffer, nStackDepth + 1 );
 				break;
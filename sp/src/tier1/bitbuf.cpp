@@ -769,6 +769,14 @@ bool bf_write::WriteString(const char *pStr)
 {
 	if(pStr)
 	{
+		// Write the whole string at once when it fits; WriteBits block copies
+		// when the cursor is byte aligned. Otherwise write what fits, char by char.
+		int nBits = ( Q_strlen( pStr ) + 1 ) << 3;
+		if ( nBits <= GetNumBitsLeft() )
+		{
+			return WriteBits( pStr, nBits );
+		}
+
 		do
 		{
 			WriteChar( *pStr );
@@ -892,6 +900,18 @@ void bf_read::ReadBits(void *pOutData, int nBits)
 		nBitsLeft -= 8;
 	}
 
+	if ( IsPC() && (nBitsLeft >= 32) && (m_iCurBit & 7) == 0 && nBitsLeft <= GetNumBitsLeft() )
+	{
+		// current bit is byte aligned, do block copy
+		int numbytes = nBitsLeft >> 3;
+		int numbits = numbytes << 3;
+
+		Q_memcpy( pOut, m_pData + (m_iCurBit >> 3), numbytes );
+		pOut += numbytes;
+		nBitsLeft -= numbits;
+		m_iCurBit += numbits;
+	}
+
 	// X360TBD: Can't read dwords in ReadBits because they'll get swapped
 	if ( IsPC() )
 	{
@@ -1376,6 +1396,38 @@ bool bf_read::ReadString( char *pStr, int maxLen, bool bLine, int *pOutNumChars
 {
 	Assert( maxLen != 0 );
 
+	// Byte-aligned strings with a terminator inside the buffer can be scanned
+	// and copied in place; anything else takes the char-by-char path below.
+	if ( IsPC() && (m_iCurBit & 7) == 0 )
+	{
+		const unsigned char *pStart = m_pData + (m_iCurBit >> 3);
+		int nBytesLeft = GetNumBytesLeft();
+
+		const unsigned char *pEnd = (const unsigned char *)memchr( pStart, 0, nBytesLeft );
+		if ( bLine )
+		{
+			const unsigned char *pNewline = (const unsigned char *)memchr( pStart, '\n', pEnd ? pEnd - pStart : nBytesLeft );
+			if ( pNewline )
+			{
+				pEnd = pNewline;
+			}
+		}
+
+		if ( pEnd )
+		{
+			int nChars = pEnd - pStart;
+			int nCopy = MIN( nChars, maxLen - 1 );
+			Q_memcpy( pStr, pStart, nCopy );
+			pStr[nCopy] = 0;
+			m_iCurBit += (nChars + 1) << 3;
+
+			if ( pOutNumChars )
+				*pOutNumChars = nCopy;
+
+			return !IsOverflowed() && nCopy == nChars;
+		}
+	}
+
 	bool bTooSmall = false;
 	int iChar = 0;
 	while(1)
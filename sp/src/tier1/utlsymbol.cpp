@@ -15,6 +15,7 @@
 #include "stringpool.h"
 #include "utlhashtable.h"
 #include "utlstring.h"
+#include "generichash.h"
 
 // Ensure that everybody has the right compiler version installed. The version
 // number can be obtained by looking at the compiler output when you type 'cl'
@@ -36,9 +37,9 @@
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
 
-#define INVALID_STRING_INDEX CStringPoolIndex( 0xFFFF, 0xFFFF )
-
 #define MIN_STRING_POOL_SIZE	2048
+#define MIN_HASH_SLOTS			32
+#define SYMBOL_HASH_SEED		0x5354524e
 
 //-----------------------------------------------------------------------------
 // globals
@@ -126,37 +127,44 @@ bool CUtlSymbol::operator==( const char* pStr ) const
 // symbol table stuff
 //-----------------------------------------------------------------------------
 
-inline const char* CUtlSymbolTable::StringFromIndex( const CStringPoolIndex &index ) const
+#define SYMBOL_BLOCK_SHIFT		8
+#define SYMBOL_BLOCK_SIZE		( 1 << SYMBOL_BLOCK_SHIFT )
+#define SYMBOL_BLOCK_COUNT		( ( UTL_INVAL_SYMBOL + 1 ) >> SYMBOL_BLOCK_SHIFT )
+
+struct SymbolEntry_t
 {
-	Assert( index.m_iPool < m_StringPools.Count() );
-	Assert( index.m_iOffset < m_StringPools[index.m_iPool]->m_TotalLen );
+	const char *m_pString;
+	unsigned	m_nHash;
+};
 
-	return &m_StringPools[index.m_iPool]->m_Data[index.m_iOffset];
-}
+// Slot array and its mask live in one allocation so they're swapped together
+struct SymbolHashSlots_t
+{
+	unsigned	m_nMask;
+	UtlSymId_t	m_Slots[1];
+};
+
+// Lives outside CUtlSymbolTable so the class keeps its original layout, and
+// is only allocated once a table actually holds a string.
+struct UtlSymbolHashIndex_t
+{
+	SymbolHashSlots_t * volatile m_pHashSlots;
+	CUtlVector<SymbolHashSlots_t*> m_RetiredHashSlots;	// replaced slot arrays, kept for readers still probing them
+	SymbolEntry_t *m_pSymbolBlocks[SYMBOL_BLOCK_COUNT];
+	int m_nSymbols;
 
+	const SymbolEntry_t &Entry( UtlSymId_t id ) const
+	{
+		return m_pSymbolBlocks[ id >> SYMBOL_BLOCK_SHIFT ][ id & ( SYMBOL_BLOCK_SIZE - 1 ) ];
+	}
+};
 
-bool CUtlSymbolTable::CLess::operator()( const CStringPoolIndex &i1, const CStringPoolIndex &i2 ) const
+inline unsigned CUtlSymbolTable::HashString( const char *pString ) const
 {
-	// Need to do pointer math because CUtlSymbolTable is used in CUtlVectors, and hence
-	// can be arbitrarily moved in memory on a realloc. Yes, this is portable. In reality,
-	// right now at least, because m_LessFunc is the first member of CUtlRBTree, and m_Lookup
-	// is the first member of CUtlSymbolTabke, this == pTable
-	CUtlSymbolTable *pTable = (CUtlSymbolTable *)( (byte *)this - offsetof(CUtlSymbolTable::CTree, m_LessFunc) ) - offsetof(CUtlSymbolTable, m_Lookup );
-	const char* str1 = (i1 == INVALID_STRING_INDEX) ? pTable->m_pUserSearchString :
-													  pTable->StringFromIndex( i1 );
-	const char* str2 = (i2 == INVALID_STRING_INDEX) ? pTable->m_pUserSearchString :
-													  pTable->StringFromIndex( i2 );
-
-	if ( !str1 && str2 )
-		return false;
-	if ( !str2 && str1 )
-		return true;
-	if ( !str1 && !str2 )
-		return false;
-	if ( !pTable->m_bInsensitive )
-		return V_strcmp( str1, str2 ) < 0;
-	else
-		return V_stricmp( str1, str2 ) < 0;
+	if ( m_bInsensitive )
+		return MurmurHash2LowerCase( pString, SYMBOL_HASH_SEED );
+
+	return MurmurHash2( pString, V_strlen( pString ), SYMBOL_HASH_SEED );
 }
 
 
@@ -164,7 +172,7 @@ bool CUtlSymbolTable::CLess::operator()( const CStringPoolIndex &i1, const CStri
 // constructor, destructor
 //-----------------------------------------------------------------------------
 CUtlSymbolTable::CUtlSymbolTable( int growSize, int initSize, bool caseInsensitive ) : 
-	m_Lookup( growSize, initSize ), m_bInsensitive( caseInsensitive ), m_StringPools( 8 )
+	m_Lookup( 0, 0 ), m_bInsensitive( caseInsensitive ), m_pHashIndex( NULL ), m_StringPools( 8 )
 {
 }
 
@@ -175,23 +183,40 @@ CUtlSymbolTable::~CUtlSymbolTable()
 }
 
 
+//-----------------------------------------------------------------------------
+// Probes the slot array for pString. Safe to call while another thread adds
+// strings: entries are written before their slot, and a grown slot array is
+// filled before it's published.
+//-----------------------------------------------------------------------------
+UtlSymId_t CUtlSymbolTable::FindWithHash( const char *pString, unsigned nHash ) const
+{
+	const UtlSymbolHashIndex_t *pIndex = m_pHashIndex;
+	if ( !pIndex )
+		return UTL_INVAL_SYMBOL;
+
+	const SymbolHashSlots_t *pSlots = pIndex->m_pHashSlots;
+	for ( unsigned iSlot = nHash & pSlots->m_nMask; ; iSlot = ( iSlot + 1 ) & pSlots->m_nMask )
+	{
+		UtlSymId_t id = pSlots->m_Slots[iSlot];
+		if ( id == UTL_INVAL_SYMBOL )
+			return UTL_INVAL_SYMBOL;
+
+		const SymbolEntry_t &entry = pIndex->Entry( id );
+		if ( entry.m_nHash == nHash )
+		{
+			if ( m_bInsensitive ? !V_stricmp( entry.m_pString, pString ) : !V_strcmp( entry.m_pString, pString ) )
+				return id;
+		}
+	}
+}
+
+
 CUtlSymbol CUtlSymbolTable::Find( const char* pString ) const
 {	
 	if (!pString)
 		return CUtlSymbol();
 	
-	// Store a special context used to help with insertion
-	m_pUserSearchString = pString;
-	
-	// Passing this special invalid symbol makes the comparison function
-	// use the string passed in the context
-	UtlSymId_t idx = m_Lookup.Find( INVALID_STRING_INDEX );
-
-#ifdef _DEBUG
-	m_pUserSearchString = NULL;
-#endif
-
-	return CUtlSymbol( idx );
+	return CUtlSymbol( FindWithHash( pString, HashString( pString ) ) );
 }
 
 
@@ -211,6 +236,46 @@ int CUtlSymbolTable::FindPoolWithSpace( int len )	const
 }
 
 
+static void InsertIntoSlots( SymbolHashSlots_t *pSlots, UtlSymId_t id, unsigned nHash )
+{
+	unsigned iSlot = nHash & pSlots->m_nMask;
+	while ( pSlots->m_Slots[iSlot] != UTL_INVAL_SYMBOL )
+	{
+		iSlot = ( iSlot + 1 ) & pSlots->m_nMask;
+	}
+	pSlots->m_Slots[iSlot] = id;
+}
+
+
+//-----------------------------------------------------------------------------
+// Doubles the slot array (keeping it at most half full) and rehashes from the
+// cached hashes. The old array is retired, not freed, since a reader may still
+// be probing it.
+//-----------------------------------------------------------------------------
+static void GrowHashSlots( UtlSymbolHashIndex_t *pIndex )
+{
+	unsigned nSlots = pIndex->m_pHashSlots ? ( pIndex->m_pHashSlots->m_nMask + 1 ) * 2 : MIN_HASH_SLOTS;
+
+	SymbolHashSlots_t *pNewSlots = (SymbolHashSlots_t*)malloc( sizeof( SymbolHashSlots_t ) + ( nSlots - 1 ) * sizeof( UtlSymId_t ) );
+	pNewSlots->m_nMask = nSlots - 1;
+	memset( pNewSlots->m_Slots, 0xFF, nSlots * sizeof( UtlSymId_t ) );
+
+	for ( int i = 0; i < pIndex->m_nSymbols; i++ )
+	{
+		InsertIntoSlots( pNewSlots, (UtlSymId_t)i, pIndex->Entry( (UtlSymId_t)i ).m_nHash );
+	}
+
+	ThreadMemoryBarrier();
+
+	SymbolHashSlots_t *pOldSlots = pIndex->m_pHashSlots;
+	if ( pOldSlots )
+	{
+		pIndex->m_RetiredHashSlots.AddToTail( pOldSlots );
+	}
+	pIndex->m_pHashSlots = pNewSlots;
+}
+
+
 //-----------------------------------------------------------------------------
 // Finds and/or creates a symbol based on the string
 //-----------------------------------------------------------------------------
@@ -220,10 +285,36 @@ CUtlSymbol CUtlSymbolTable::AddString( const char* pString )
 	if (!pString) 
 		return CUtlSymbol( UTL_INVAL_SYMBOL );
 
-	CUtlSymbol id = Find( pString );
+	unsigned nHash = HashString( pString );
+	UtlSymId_t id = FindWithHash( pString, nHash );
 	
-	if (id.IsValid())
-		return id;
+	if ( id != UTL_INVAL_SYMBOL )
+		return CUtlSymbol( id );
+
+	UtlSymbolHashIndex_t *pIndex = m_pHashIndex;
+	if ( !pIndex )
+	{
+		pIndex = new UtlSymbolHashIndex_t;
+		pIndex->m_pHashSlots = NULL;
+		pIndex->m_nSymbols = 0;
+		memset( pIndex->m_pSymbolBlocks, 0, sizeof( pIndex->m_pSymbolBlocks ) );
+		GrowHashSlots( pIndex );
+
+		// Fully built before readers can see it
+		ThreadMemoryBarrier();
+		m_pHashIndex = pIndex;
+	}
+
+	if ( pIndex->m_nSymbols >= UTL_INVAL_SYMBOL )
+	{
+		AssertMsg( 0, "CUtlSymbolTable overflow\n" );
+		return CUtlSymbol( UTL_INVAL_SYMBOL );
+	}
+
+	if ( ( pIndex->m_nSymbols + 1 ) * 2 > (int)( pIndex->m_pHashSlots->m_nMask + 1 ) )
+	{
+		GrowHashSlots( pIndex );
+	}
 
 	int len = V_strlen(pString) + 1;
 
@@ -241,21 +332,27 @@ CUtlSymbol CUtlSymbolTable::AddString( const char* pString )
 
 	// Copy the string in.
 	StringPool_t *pPool = m_StringPools[iPool];
-	Assert( pPool->m_SpaceUsed < 0xFFFF );	// This should never happen, because if we had a string > 64k, it
-											// would have been given its entire own pool.
-	
-	unsigned short iStringOffset = pPool->m_SpaceUsed;
-
-	memcpy( &pPool->m_Data[pPool->m_SpaceUsed], pString, len );
+	char *pStringCopy = &pPool->m_Data[pPool->m_SpaceUsed];
+	memcpy( pStringCopy, pString, len );
 	pPool->m_SpaceUsed += len;
 
-	// didn't find, insert the string into the vector.
-	CStringPoolIndex index;
-	index.m_iPool = iPool;
-	index.m_iOffset = iStringOffset;
+	// Fill in the entry before the slot that makes it findable
+	id = (UtlSymId_t)pIndex->m_nSymbols;
+	SymbolEntry_t *&pBlock = pIndex->m_pSymbolBlocks[ id >> SYMBOL_BLOCK_SHIFT ];
+	if ( !pBlock )
+	{
+		pBlock = (SymbolEntry_t*)malloc( SYMBOL_BLOCK_SIZE * sizeof( SymbolEntry_t ) );
+	}
+	SymbolEntry_t &entry = pBlock[ id & ( SYMBOL_BLOCK_SIZE - 1 ) ];
+	entry.m_pString = pStringCopy;
+	entry.m_nHash = nHash;
+	++pIndex->m_nSymbols;
+	m_Lookup.SetNumElements( (unsigned short)pIndex->m_nSymbols );
+
+	ThreadMemoryBarrier();
 
-	UtlSymId_t idx = m_Lookup.Insert( index );
-	return CUtlSymbol( idx );
+	InsertIntoSlots( pIndex->m_pHashSlots, id, nHash );
+	return CUtlSymbol( id );
 }
 
 
@@ -268,8 +365,9 @@ const char* CUtlSymbolTable::String( CUtlSymbol id ) const
 	if (!id.IsValid()) 
 		return "";
 	
-	Assert( m_Lookup.IsValidIndex((UtlSymId_t)id) );
-	return StringFromIndex( m_Lookup[id] );
+	const UtlSymbolHashIndex_t *pIndex = m_pHashIndex;
+	Assert( pIndex && (UtlSymId_t)id < pIndex->m_nSymbols );
+	return pIndex->Entry( id ).m_pString;
 }
 
 
@@ -279,7 +377,22 @@ const char* CUtlSymbolTable::String( CUtlSymbol id ) const
 
 void CUtlSymbolTable::RemoveAll()
 {
-	m_Lookup.Purge();
+	UtlSymbolHashIndex_t *pIndex = m_pHashIndex;
+	if ( pIndex )
+	{
+		m_pHashIndex = NULL;
+
+		free( pIndex->m_pHashSlots );
+		for ( int i=0; i < pIndex->m_RetiredHashSlots.Count(); i++ )
+			free( pIndex->m_RetiredHashSlots[i] );
+
+		for ( int i=0; i < SYMBOL_BLOCK_COUNT; i++ )
+			free( pIndex->m_pSymbolBlocks[i] );
+
+		delete pIndex;
+	}
+
+	m_Lookup.SetNumElements( 0 );
 	
 	for ( int i=0; i < m_StringPools.Count(); i++ )
 		free( m_StringPools[i] );